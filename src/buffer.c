@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal size of the buffers
+#define BUF_MIN_SIZE 256
+
+// Number of heap allocations made by buffers
+static size_t allocs;
+
+bool buf_reserve(struct buffer* buf, size_t size)
+{
+    if (size > buf->size) {
+        size_t sz = buf->size ? buf->size : BUF_MIN_SIZE;
+        while (sz < size) {
+            sz *= 2;
+        }
+        char* data = realloc(buf->data, sz);
+        if (!data) {
+            fprintf(stderr, "Not enough memory\n");
+            return false;
+        }
+        buf->data = data;
+        buf->size = sz;
+        ++allocs;
+    }
+    return true;
+}
+
+size_t buf_allocs(void)
+{
+    return allocs;
+}
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Buffer, retained between uses and grown on demand. */
+struct buffer {
+    char* data;
+    size_t size;
+};
+
+/**
+ * Reserve space in the buffer.
+ * The buffer grows by powers of 2, each growth is a counted heap allocation.
+ * @param[in] buf buffer
+ * @param[in] size required size in bytes
+ * @return false if not enough memory
+ */
+bool buf_reserve(struct buffer* buf, size_t size);
+
+/**
+ * Get number of heap allocations made by all buffers.
+ * @return number of allocations
+ */
+size_t buf_allocs(void);
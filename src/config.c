@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "config.h"
+#include "loop.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+// Max length of the config line
+#define LINE_MAX_LEN 1024
+
+// Inotify instance and name of the watched file in the watched directory
+static int notify_fd = -1;
+static char* watch_name;
+static config_changed_cb handle_change;
+
+/**
+ * Parse non-negative number.
+ * @param[in] value text to parse
+ * @param[in] max max valid number
+ * @param[out] num parsed number
+ * @return false if the text is not a valid number
+ */
+static bool parse_num(const char* value, long max, long* num)
+{
+    char* end;
+    errno = 0;
+    *num = strtol(value, &end, 10);
+    return errno == 0 && end != value && !*end && *num >= 0 && *num <= max;
+}
+
+/**
+ * Apply setting.
+ * @param[in] cfg settings to modify
+ * @param[in] key name of the setting
+ * @param[in] value value of the setting
+ * @return false if the key or value is invalid
+ */
+static bool set_option(struct config* cfg, const char* key, const char* value)
+{
+    char line[LINE_MAX_LEN];
+    long num;
+
+    if (strcmp(key, "default") == 0) {
+        if (!parse_num(value, 0xffff, &num)) {
+            return false;
+        }
+        cfg->default_layout = num;
+    } else if (strcmp(key, "tabapps") == 0) {
+        matcher_free(&cfg->tab_apps);
+        if (!matcher_add_list(&cfg->tab_apps, value, 0)) {
+            fprintf(stderr, "Not enough memory\n");
+            return false;
+        }
+    } else if (strcmp(key, "maxtabs") == 0) {
+        if (!parse_num(value, INT_MAX, &num)) {
+            return false;
+        }
+        cfg->max_tabs = num;
+    } else if (strcmp(key, "maxstates") == 0) {
+        if (!parse_num(value, INT_MAX, &num)) {
+            return false;
+        }
+        cfg->max_states = num;
+    } else if (strcmp(key, "debounce") == 0) {
+        if (!parse_num(value, INT_MAX, &num)) {
+            return false;
+        }
+        cfg->debounce = num;
+    } else if (strcmp(key, "rules") == 0) {
+        return rules_load(&cfg->rules, value);
+    } else if (strcmp(key, "rule") == 0) {
+        // the rule parser modifies the line, the value can be applied again
+        if (strlen(value) >= sizeof(line)) {
+            return false;
+        }
+        strcpy(line, value);
+        return rules_add(&cfg->rules, line);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parse config line and apply the setting.
+ * @param[in] cfg settings to modify
+ * @param[in] line config line without leading spaces, modified by the function
+ * @return false if the line is invalid
+ */
+static bool parse_line(struct config* cfg, char* line)
+{
+    char* value = line + strcspn(line, " \t=");
+    char* end;
+
+    value += strspn(value, " \t");
+    if (*value != '=') {
+        return false;
+    }
+    *value++ = 0;
+    end = line + strcspn(line, " \t");
+    *end = 0;
+
+    value += strspn(value, " \t");
+    end = value + strlen(value);
+    while (end > value && isspace((unsigned char)end[-1])) {
+        --end;
+    }
+    *end = 0;
+
+    return set_option(cfg, line, value);
+}
+
+/**
+ * Load settings from the config file.
+ * @param[in] cfg settings to modify
+ * @param[in] path path to the config file
+ * @return false on errors
+ */
+static bool load_file(struct config* cfg, const char* path)
+{
+    char line[LINE_MAX_LEN];
+    size_t num = 0;
+    bool rc = true;
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to open config file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        return false;
+    }
+
+    while (rc && fgets(line, sizeof(line), fp)) {
+        char* text = line + strspn(line, " \t");
+        ++num;
+        text[strcspn(text, "\r\n")] = 0;
+        if (*text && *text != '#' && !parse_line(cfg, text)) {
+            fprintf(stderr, "Invalid config at %s:%zu\n", path, num);
+            rc = false;
+        }
+    }
+
+    fclose(fp);
+    return rc;
+}
+
+struct config* config_load(const char* path, const struct config_option* opts,
+                           size_t num)
+{
+    struct config* cfg = calloc(1, sizeof(*cfg));
+    if (!cfg) {
+        fprintf(stderr, "Not enough memory\n");
+        return NULL;
+    }
+
+    cfg->default_layout = DEFAULT_LAYOUT;
+    cfg->debounce = DEFAULT_DEBOUNCE;
+    cfg->max_tabs = DEFAULT_MAXTABS;
+    cfg->max_states = DEFAULT_MAXSTATES;
+    bool rc = matcher_add_list(&cfg->tab_apps, DEFAULT_TABAPPS, 0);
+    if (!rc) {
+        fprintf(stderr, "Not enough memory\n");
+    }
+
+    if (rc && path) {
+        rc = load_file(cfg, path);
+    }
+    for (size_t i = 0; rc && i < num; ++i) {
+        rc = set_option(cfg, opts[i].key, opts[i].value);
+        if (!rc) {
+            fprintf(stderr, "Invalid %s: %s\n", opts[i].key, opts[i].value);
+        }
+    }
+
+    if (!rc) {
+        config_free(cfg);
+        cfg = NULL;
+    }
+    return cfg;
+}
+
+void config_free(struct config* cfg)
+{
+    if (cfg) {
+        matcher_free(&cfg->tab_apps);
+        rules_free(&cfg->rules);
+        free(cfg);
+    }
+}
+
+/** Inotify handler, see loop_fd_cb for details. */
+static int on_notify(int fd, uint32_t events, void* data)
+{
+    union {
+        struct inotify_event event;
+        char buf[4096];
+    } ev;
+    bool changed = false;
+    ssize_t len;
+
+    (void)events;
+    (void)data;
+
+    // editors generate several events per save, handle them at once
+    while ((len = read(fd, ev.buf, sizeof(ev.buf))) > 0) {
+        const char* ptr = ev.buf;
+        while (ptr < ev.buf + len) {
+            const struct inotify_event* event = (const void*)ptr;
+            if (event->len && strcmp(event->name, watch_name) == 0) {
+                changed = true;
+            }
+            ptr += sizeof(*event) + event->len;
+        }
+    }
+
+    if (changed) {
+        handle_change();
+    }
+
+    return 0;
+}
+
+int config_watch(const char* path, config_changed_cb cb)
+{
+    const char* name = strrchr(path, '/');
+    char* dir;
+    int rc;
+
+    if (name) {
+        dir = strndup(path, name == path ? 1 : (size_t)(name - path));
+        ++name;
+    } else {
+        dir = strdup(".");
+        name = path;
+    }
+    watch_name = strdup(name);
+    if (!dir || !watch_name) {
+        fprintf(stderr, "Not enough memory\n");
+        free(dir);
+        config_unwatch();
+        return ENOMEM;
+    }
+
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd == -1 ||
+        inotify_add_watch(notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        rc = errno;
+        fprintf(stderr, "Unable to watch config directory %s: [%i] %s\n", dir,
+                rc, strerror(rc));
+        free(dir);
+        config_unwatch();
+        return rc;
+    }
+    free(dir);
+
+    handle_change = cb;
+
+    rc = loop_add(notify_fd, EPOLLIN, on_notify, NULL);
+    if (rc) {
+        config_unwatch();
+    }
+
+    return rc;
+}
+
+void config_unwatch(void)
+{
+    if (notify_fd != -1) {
+        loop_remove(notify_fd);
+        close(notify_fd);
+        notify_fd = -1;
+    }
+    free(watch_name);
+    watch_name = NULL;
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "matcher.h"
+#include "rules.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default layout for new windows
+#define DEFAULT_LAYOUT  0
+// Default list of tab-enabled app IDs
+#define DEFAULT_TABAPPS "firefox*,chrom*,google-chrome*"
+// Default max number of stored tabs per window
+#define DEFAULT_MAXTABS 256
+// Default max number of stored window/tab states
+#define DEFAULT_MAXSTATES 16384
+// Default quiet period of title changes, milliseconds
+#define DEFAULT_DEBOUNCE 100
+
+/** Compiled settings, never modified after loading. */
+struct config {
+    int default_layout;      ///< layout for new windows
+    size_t debounce;         ///< quiet period of title changes, ms
+    size_t max_tabs;         ///< max number of stored tabs per window
+    size_t max_states;       ///< max number of stored states
+    struct matcher tab_apps; ///< tab-enabled applications
+    struct rules rules;      ///< rules of initial layouts
+};
+
+/** Setting from the command line, takes precedence over the config file. */
+struct config_option {
+    const char* key;
+    const char* value;
+};
+
+/**
+ * Callback: config file was changed.
+ */
+typedef void (*config_changed_cb)(void);
+
+/**
+ * Load settings: defaults, then the config file, then the options.
+ * The config file consists of "KEY = VALUE" lines, where KEY is one of
+ * "default", "tabapps", "maxtabs", "maxstates", "debounce", "rules" (path to
+ * the rules file) or "rule" (single rule, see rules_add). Empty lines and
+ * lines starting with '#' are ignored.
+ * @param[in] path path to the config file, NULL to use defaults
+ * @param[in] opts array of options
+ * @param[in] num number of options in the array
+ * @return compiled settings, NULL on errors
+ */
+struct config* config_load(const char* path, const struct config_option* opts,
+                           size_t num);
+
+/**
+ * Free settings.
+ * @param[in] cfg settings to free, can be NULL
+ */
+void config_free(struct config* cfg);
+
+/**
+ * Start watching the config file for changes.
+ * The directory of the file is watched, so files replaced by editors
+ * (written to a temporary file and renamed) are detected too.
+ * @param[in] path path to the config file
+ * @param[in] cb change handler, called once per burst of changes
+ * @return error code, 0 on success
+ */
+int config_watch(const char* path, config_changed_cb cb);
+
+/**
+ * Stop watching the config file.
+ */
+void config_unwatch(void);
@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "control.h"
+#include "loop.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Max number of connected clients
+#define CLIENTS_MAX 8
+// Max length of the request line
+#define REQUEST_MAX 256
+// Max length of the reply/notification line
+#define LINE_MAX_LEN 256
+// Max size of data queued for a client, the client is dropped if exceeded
+#define OUTPUT_MAX (1024 * 1024)
+
+/** Control client. */
+struct client {
+    int fd;          ///< socket descriptor, -1 if the slot is free
+    bool subscribed; ///< client receives notifications
+    bool closing;    ///< client closed its side, drop after sending the rest
+    uint32_t events; ///< watched epoll events
+    char in[REQUEST_MAX + 1 /* last null */];
+    size_t in_len;
+    char* out;
+    size_t out_len;
+    size_t out_size;
+};
+
+static int listen_sock = -1;
+static char* socket_path;
+static control_request_cb handle_request;
+
+static struct client clients[CLIENTS_MAX];
+static size_t subscribers;
+
+/**
+ * Disconnect client and free its resources.
+ * @param[in] cl client to drop
+ */
+static void drop_client(struct client* cl)
+{
+    loop_remove(cl->fd);
+    close(cl->fd);
+    free(cl->out);
+    if (cl->subscribed) {
+        --subscribers;
+    }
+    memset(cl, 0, sizeof(*cl));
+    cl->fd = -1;
+}
+
+/**
+ * Send queued data to the client without blocking.
+ * @param[in] cl client
+ * @return false if the client was dropped
+ */
+static bool flush_client(struct client* cl)
+{
+    size_t sent = 0;
+    while (sent < cl->out_len) {
+        const ssize_t rc = send(cl->fd, cl->out + sent, cl->out_len - sent,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break; // continue when the socket becomes writable
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            drop_client(cl);
+            return false;
+        }
+        sent += rc;
+    }
+    cl->out_len -= sent;
+    memmove(cl->out, cl->out + sent, cl->out_len);
+
+    if (cl->closing && cl->out_len == 0) {
+        drop_client(cl);
+        return false;
+    }
+
+    // watch for the socket writability only while the queue is not empty
+    const uint32_t events =
+        (cl->closing ? 0 : EPOLLIN) | (cl->out_len ? EPOLLOUT : 0);
+    if (cl->events != events) {
+        cl->events = events;
+        loop_modify(cl->fd, events);
+    }
+
+    return true;
+}
+
+/**
+ * Put line to the client's output queue.
+ * @param[in] cl client
+ * @param[in] fmt format of the line
+ * @param[in] args format arguments
+ * @return false if the client was dropped
+ */
+static bool queue_line(struct client* cl, const char* fmt, va_list args)
+{
+    char line[LINE_MAX_LEN];
+    int len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    if (len < 0) {
+        return true;
+    }
+    if ((size_t)len > sizeof(line) - 2) {
+        len = sizeof(line) - 2; // truncated
+    }
+    line[len++] = '\n';
+
+    const size_t size = cl->out_len + len;
+    if (size > OUTPUT_MAX) {
+        fprintf(stderr, "Control client doesn't read data, disconnected\n");
+        drop_client(cl);
+        return false;
+    }
+    if (size > cl->out_size) {
+        size_t sz = cl->out_size ? cl->out_size : LINE_MAX_LEN;
+        while (sz < size) {
+            sz *= 2;
+        }
+        char* out = realloc(cl->out, sz);
+        if (!out) {
+            fprintf(stderr, "Not enough memory\n");
+            drop_client(cl);
+            return false;
+        }
+        cl->out = out;
+        cl->out_size = sz;
+    }
+    memcpy(cl->out + cl->out_len, line, len);
+    cl->out_len += len;
+
+    return true;
+}
+
+/**
+ * Read requests from the client and handle them.
+ * @param[in] cl client
+ * @return false if the client was dropped
+ */
+static bool read_client(struct client* cl)
+{
+    const ssize_t rc = recv(cl->fd, cl->in + cl->in_len,
+                            REQUEST_MAX - cl->in_len, MSG_DONTWAIT);
+    if (rc == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return true;
+        }
+        drop_client(cl);
+        return false;
+    }
+    if (rc == 0) {
+        // client doesn't send anymore, but can wait for replies
+        cl->closing = true;
+    }
+    cl->in_len += rc;
+
+    const int client = cl - clients;
+    char* start = cl->in;
+    char* end;
+    while (cl->fd != -1 &&
+           (end = memchr(start, '\n', cl->in_len - (start - cl->in)))) {
+        *end = 0;
+        if (end > start && end[-1] == '\r') {
+            end[-1] = 0;
+        }
+        handle_request(client, start);
+        start = end + 1;
+    }
+    if (cl->fd == -1) {
+        return false;
+    }
+    cl->in_len -= start - cl->in;
+    memmove(cl->in, start, cl->in_len);
+
+    if (cl->closing && cl->in_len) {
+        // last request without new line
+        cl->in[cl->in_len] = 0;
+        cl->in_len = 0;
+        handle_request(client, cl->in);
+        return cl->fd != -1;
+    }
+
+    if (cl->in_len == REQUEST_MAX) {
+        fprintf(stderr, "Control request is too long, client disconnected\n");
+        drop_client(cl);
+        return false;
+    }
+
+    return true;
+}
+
+/** Client socket handler, see loop_fd_cb for details. */
+static int on_client(int fd, uint32_t events, void* data)
+{
+    struct client* cl = data;
+
+    (void)fd;
+
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)) {
+        drop_client(cl);
+        return 0;
+    }
+    if ((events & EPOLLIN) && !read_client(cl)) {
+        return 0;
+    }
+    flush_client(cl);
+
+    return 0;
+}
+
+/** Listening socket handler, see loop_fd_cb for details. */
+static int on_connect(int fd, uint32_t events, void* data)
+{
+    (void)events;
+    (void)data;
+
+    // client sockets are used with MSG_DONTWAIT, so they never block
+    const int sock = accept(fd, NULL, NULL);
+    if (sock == -1) {
+        return 0;
+    }
+
+    struct client* cl = NULL;
+    for (size_t i = 0; i < CLIENTS_MAX; ++i) {
+        if (clients[i].fd == -1) {
+            cl = &clients[i];
+            break;
+        }
+    }
+    if (!cl || loop_add(sock, EPOLLIN, on_client, cl)) {
+        fprintf(stderr, "Too many control clients\n");
+        close(sock);
+        return 0;
+    }
+    cl->fd = sock;
+    cl->events = EPOLLIN;
+
+    return 0;
+}
+
+int control_init(const char* path, control_request_cb cb)
+{
+    struct sockaddr_un sa;
+    int rc;
+
+    for (size_t i = 0; i < CLIENTS_MAX; ++i) {
+        clients[i].fd = -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "Control socket path is too long: %s\n", path);
+        return ENAMETOOLONG;
+    }
+    strcpy(sa.sun_path, path);
+
+    // remove stale socket file, but never anything else at that path
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Control socket path is not a socket: %s\n",
+                    path);
+            return EEXIST;
+        }
+        if (unlink(path) == -1) {
+            rc = errno;
+            fprintf(stderr, "Failed to remove stale control socket %s: "
+                            "[%i] %s\n",
+                    path, rc, strerror(rc));
+            return rc;
+        }
+    }
+
+    listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sock == -1) {
+        rc = errno;
+        fprintf(stderr, "Failed to create control socket: [%i] %s\n", rc,
+                strerror(rc));
+        return rc;
+    }
+
+    const mode_t mask = umask(S_IRWXG | S_IRWXO);
+    rc = bind(listen_sock, (struct sockaddr*)&sa, sizeof(sa));
+    umask(mask);
+    if (rc == 0) {
+        rc = listen(listen_sock, CLIENTS_MAX);
+    }
+    if (rc == 0) {
+        rc = fcntl(listen_sock, F_SETFL,
+                   fcntl(listen_sock, F_GETFL) | O_NONBLOCK);
+    }
+    if (rc == -1) {
+        rc = errno;
+        fprintf(stderr, "Failed to bind control socket %s: [%i] %s\n", path,
+                rc, strerror(rc));
+        close(listen_sock);
+        listen_sock = -1;
+        return rc;
+    }
+
+    socket_path = strdup(path);
+    handle_request = cb;
+
+    rc = loop_add(listen_sock, EPOLLIN, on_connect, NULL);
+    if (rc) {
+        control_close();
+    }
+
+    return rc;
+}
+
+void control_close(void)
+{
+    if (listen_sock == -1) {
+        return;
+    }
+    for (size_t i = 0; i < CLIENTS_MAX; ++i) {
+        if (clients[i].fd != -1) {
+            drop_client(&clients[i]);
+        }
+    }
+    loop_remove(listen_sock);
+    close(listen_sock);
+    listen_sock = -1;
+    if (socket_path) {
+        unlink(socket_path);
+        free(socket_path);
+        socket_path = NULL;
+    }
+}
+
+void control_reply(int client, const char* fmt, ...)
+{
+    struct client* cl = &clients[client];
+    va_list args;
+
+    if (cl->fd != -1) {
+        va_start(args, fmt);
+        // sent by the socket handler after processing the whole request
+        queue_line(cl, fmt, args);
+        va_end(args);
+    }
+}
+
+void control_subscribe(int client)
+{
+    struct client* cl = &clients[client];
+    if (cl->fd != -1 && !cl->subscribed) {
+        cl->subscribed = true;
+        ++subscribers;
+    }
+}
+
+void control_notify(const char* fmt, ...)
+{
+    va_list args;
+
+    if (subscribers == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < CLIENTS_MAX; ++i) {
+        struct client* cl = &clients[i];
+        if (cl->fd != -1 && cl->subscribed) {
+            va_start(args, fmt);
+            if (queue_line(cl, fmt, args)) {
+                flush_client(cl);
+            }
+            va_end(args);
+        }
+    }
+}
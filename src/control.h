@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+/**
+ * Callback function: Request received from the control client.
+ * @param[in] client client identifier
+ * @param[in] request request line without trailing new line, can be modified
+ */
+typedef void (*control_request_cb)(int client, char* request);
+
+/**
+ * Create control socket and start accepting clients.
+ * Clients send requests as text lines, replies and notifications are lines
+ * too. All client I/O is non-blocking, client that doesn't read its data
+ * is disconnected. A stale socket file is replaced, the function fails if
+ * the path exists and is not a socket.
+ * @param[in] path path to the unix socket file
+ * @param[in] cb request handler
+ * @return error code, 0 on success
+ */
+int control_init(const char* path, control_request_cb cb);
+
+/**
+ * Close control socket and disconnect all clients.
+ */
+void control_close(void);
+
+/**
+ * Send reply line to the client.
+ * @param[in] client client identifier
+ * @param[in] fmt format of the line (without new line), printf-like
+ */
+void control_reply(int client, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Subscribe client to notifications.
+ * @param[in] client client identifier
+ */
+void control_subscribe(int client);
+
+/**
+ * Send notification line to all subscribed clients.
+ * @param[in] fmt format of the line (without new line), printf-like
+ */
+void control_notify(const char* fmt, ...)
+    __attribute__((format(printf, 1, 2)));
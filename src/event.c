@@ -0,0 +1,595 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Check if the key (not null-terminated) is equal to the string literal
+#define KEY_IS(key, len, str) \
+    ((len) == sizeof(str) - 1 && memcmp(key, str, sizeof(str) - 1) == 0)
+
+// IPC event types (without the event bit)
+#define SOURCE_WORKSPACE 0x00
+#define SOURCE_WINDOW    0x03
+#define SOURCE_INPUT     0x15
+
+/** Event types mapped to the IPC event types and "change" field values. */
+static const struct {
+    uint32_t source;       ///< IPC event type
+    const char* subscribe; ///< name of the IPC event in subscribe request
+    const char* name;      ///< value of the "change" field
+    enum event_type type;
+} event_names[] = {
+    { SOURCE_WINDOW,    "window",    "focus",      EVENT_FOCUS     },
+    { SOURCE_WINDOW,    "window",    "title",      EVENT_TITLE     },
+    { SOURCE_WINDOW,    "window",    "close",      EVENT_CLOSE     },
+    { SOURCE_INPUT,     "input",     "xkb_layout", EVENT_LAYOUT    },
+    { SOURCE_INPUT,     "input",     "xkb_keymap", EVENT_KEYMAP    },
+    { SOURCE_INPUT,     "input",     "added",      EVENT_ADDED     },
+    { SOURCE_INPUT,     "input",     "removed",    EVENT_REMOVED   },
+    { SOURCE_WORKSPACE, "workspace", "focus",      EVENT_WORKSPACE },
+};
+
+/**
+ * Skip white spaces.
+ * @param[in] pos current position
+ * @return pointer to the first non-space character
+ */
+static char* skip_ws(char* pos)
+{
+    while (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t') {
+        ++pos;
+    }
+    return pos;
+}
+
+/**
+ * Skip string.
+ * @param[in] pos pointer to the opening quote
+ * @return pointer to the next character after the closing quote, NULL on errors
+ */
+static char* skip_string(char* pos)
+{
+    char* start = ++pos;
+    while ((pos = strchr(pos, '"'))) {
+        // check if the quote is escaped: odd number of backslashes before it
+        const char* bs = pos;
+        while (bs > start && bs[-1] == '\\') {
+            --bs;
+        }
+        if ((pos - bs) % 2 == 0) {
+            return pos + 1;
+        }
+        start = ++pos;
+    }
+    return NULL;
+}
+
+/**
+ * Skip value of any type.
+ * @param[in] pos pointer to the value
+ * @return pointer to the next character after the value, NULL on errors
+ */
+static char* skip_value(char* pos)
+{
+    int depth = 0;
+
+    pos = skip_ws(pos);
+    if (*pos == '"') {
+        return skip_string(pos);
+    }
+    if (*pos != '{' && *pos != '[') {
+        // number or literal
+        return pos + strcspn(pos, ",}] \t\r\n");
+    }
+
+    // object or array: track nesting level only
+    while ((pos = strpbrk(pos, "\"{}[]"))) {
+        if (*pos == '"') {
+            pos = skip_string(pos);
+            if (!pos) {
+                break;
+            }
+            continue;
+        }
+        if (*pos == '{' || *pos == '[') {
+            ++depth;
+        } else if (--depth == 0) {
+            return pos + 1;
+        }
+        ++pos;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get the next member of the object.
+ * @param[in,out] pos current position inside the object, on success points
+ *                    to the value of the member
+ * @param[out] key member name (not null-terminated)
+ * @param[out] len length of the member name
+ * @return false if there are no more members
+ */
+static bool next_member(char** pos, const char** key, size_t* len)
+{
+    char* ptr = skip_ws(*pos);
+    if (*ptr == ',') {
+        ptr = skip_ws(ptr + 1);
+    }
+    if (*ptr != '"') {
+        return false;
+    }
+
+    char* end = skip_string(ptr);
+    if (!end) {
+        return false;
+    }
+    *key = ptr + 1;
+    *len = end - ptr - 2;
+
+    ptr = skip_ws(end);
+    if (*ptr != ':') {
+        return false;
+    }
+    *pos = skip_ws(ptr + 1);
+
+    return true;
+}
+
+/**
+ * Enter the object.
+ * @param[in] pos pointer to the value
+ * @return pointer to the first member, NULL if value is not an object
+ */
+static char* enter_object(char* pos)
+{
+    pos = skip_ws(pos);
+    return *pos == '{' ? pos + 1 : NULL;
+}
+
+/**
+ * Leave the object.
+ * @param[in] pos current position after the last handled member
+ * @return pointer to the next character after the object, NULL on errors
+ */
+static char* leave_object(char* pos)
+{
+    pos = skip_ws(pos);
+    return *pos == '}' ? pos + 1 : NULL;
+}
+
+/**
+ * Decode 4-digit hex number.
+ * @param[in] str source string
+ * @return decoded number or -1 on errors
+ */
+static int32_t decode_hex4(const char* str)
+{
+    int32_t val = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char ch = str[i];
+        val <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            val |= ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            val |= ch - 'a' + 10;
+        } else if (ch >= 'A' && ch <= 'F') {
+            val |= ch - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return val;
+}
+
+/**
+ * Decode escaped unicode character (\uXXXX or surrogate pair) to UTF-8.
+ * @param[in,out] src pointer to the first hex digit, moved to the next char
+ * @param[in,out] dst destination pointer, moved to the next char
+ * @return false on errors
+ */
+static bool decode_unicode(char** src, char** dst)
+{
+    int32_t cp = decode_hex4(*src);
+    if (cp < 0) {
+        return false;
+    }
+    *src += 4;
+
+    if (cp >= 0xd800 && cp <= 0xdbff) {
+        // surrogate pair
+        const char* low = *src;
+        int32_t lcp;
+        if (low[0] != '\\' || low[1] != 'u' ||
+            (lcp = decode_hex4(low + 2)) < 0xdc00 || lcp > 0xdfff) {
+            return false;
+        }
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lcp - 0xdc00);
+        *src += 6;
+    }
+
+    uint8_t* out = (uint8_t*)*dst;
+    if (cp < 0x80) {
+        *out++ = cp;
+    } else if (cp < 0x800) {
+        *out++ = 0xc0 | (cp >> 6);
+        *out++ = 0x80 | (cp & 0x3f);
+    } else if (cp < 0x10000) {
+        *out++ = 0xe0 | (cp >> 12);
+        *out++ = 0x80 | ((cp >> 6) & 0x3f);
+        *out++ = 0x80 | (cp & 0x3f);
+    } else {
+        *out++ = 0xf0 | (cp >> 18);
+        *out++ = 0x80 | ((cp >> 12) & 0x3f);
+        *out++ = 0x80 | ((cp >> 6) & 0x3f);
+        *out++ = 0x80 | (cp & 0x3f);
+    }
+    *dst = (char*)out;
+
+    return true;
+}
+
+/**
+ * Get string value: unescape and null-terminate it in place.
+ * @param[in] pos pointer to the value
+ * @param[out] end pointer to the next character after the value
+ * @return pointer to the string, NULL if value is not a string
+ */
+static char* get_string(char* pos, char** end)
+{
+    pos = skip_ws(pos);
+    if (*pos != '"') {
+        *end = skip_value(pos);
+        return NULL;
+    }
+
+    char* str = pos + 1;
+    char* str_end = skip_string(pos);
+    *end = str_end;
+    if (!str_end) {
+        return NULL;
+    }
+    --str_end; // closing quote
+
+    char* src = memchr(str, '\\', str_end - str);
+    if (src) {
+        // unescape, result is always shorter than the source
+        char* dst = src;
+        while (src < str_end) {
+            if (*src != '\\') {
+                *dst++ = *src++;
+                continue;
+            }
+            ++src;
+            switch (*src++) {
+                case 'b': *dst++ = '\b'; break;
+                case 'f': *dst++ = '\f'; break;
+                case 'n': *dst++ = '\n'; break;
+                case 'r': *dst++ = '\r'; break;
+                case 't': *dst++ = '\t'; break;
+                case 'u':
+                    if (!decode_unicode(&src, &dst)) {
+                        *end = NULL;
+                        return NULL;
+                    }
+                    break;
+                default:
+                    *dst++ = src[-1]; // '"', '\\' and '/'
+                    break;
+            }
+        }
+        str_end = dst;
+    }
+    *str_end = 0;
+
+    return str;
+}
+
+/**
+ * Get integer value.
+ * @param[in] pos pointer to the value
+ * @param[out] end pointer to the next character after the value
+ * @param[out] val parsed value
+ * @return false if value is not a number
+ */
+static bool get_int(char* pos, char** end, int* val)
+{
+    char* num_end;
+    const long num = strtol(pos, &num_end, 10);
+    if (num_end == pos) {
+        *end = skip_value(pos);
+        return false;
+    }
+    *end = num_end;
+    *val = (int)num;
+    return true;
+}
+
+/**
+ * Get number of elements in the array.
+ * @param[in] pos pointer to the value
+ * @param[out] end pointer to the next character after the value
+ * @return number of elements, -1 if value is not an array
+ */
+static int get_array_size(char* pos, char** end)
+{
+    int size = 0;
+
+    pos = skip_ws(pos);
+    if (*pos != '[') {
+        *end = skip_value(pos);
+        return -1;
+    }
+
+    pos = skip_ws(pos + 1);
+    while (pos && *pos != ']') {
+        pos = skip_value(pos);
+        if (pos) {
+            ++size;
+            pos = skip_ws(pos);
+            if (*pos == ',') {
+                pos = skip_ws(pos + 1);
+            } else if (*pos != ']') {
+                pos = NULL;
+            }
+        }
+    }
+
+    *end = pos ? pos + 1 : NULL;
+    return size;
+}
+
+/**
+ * Parse "window_properties" node of XWayland window.
+ * @param[in] pos pointer to the value
+ * @param[out] ev event description
+ * @return pointer to the next character after the value, NULL on errors
+ */
+static char* parse_properties(char* pos, struct event* ev)
+{
+    const char* key;
+    size_t len;
+
+    pos = enter_object(pos);
+    if (!pos) {
+        return NULL;
+    }
+    while (pos && next_member(&pos, &key, &len)) {
+        if (KEY_IS(key, len, "class")) {
+            ev->wnd_class = get_string(pos, &pos);
+        } else {
+            pos = skip_value(pos);
+        }
+    }
+
+    return pos ? leave_object(pos) : NULL;
+}
+
+/**
+ * Parse "container" node.
+ * @param[in] pos pointer to the value
+ * @param[out] ev event description
+ * @return pointer to the next character after the value, NULL on errors
+ */
+static char* parse_container(char* pos, struct event* ev)
+{
+    const char* key;
+    size_t len;
+
+    pos = enter_object(pos);
+    if (!pos) {
+        return NULL;
+    }
+    while (pos && next_member(&pos, &key, &len)) {
+        if (KEY_IS(key, len, "id")) {
+            get_int(pos, &pos, &ev->wnd_id);
+        } else if (KEY_IS(key, len, "app_id")) {
+            ev->app_id = get_string(pos, &pos);
+        } else if (KEY_IS(key, len, "name")) {
+            ev->title = get_string(pos, &pos);
+        } else if (KEY_IS(key, len, "window_properties") &&
+                   *skip_ws(pos) == '{') {
+            pos = parse_properties(pos, ev);
+        } else {
+            pos = skip_value(pos);
+        }
+    }
+
+    return pos ? leave_object(pos) : NULL;
+}
+
+/**
+ * Parse "input" node.
+ * @param[in] pos pointer to the value
+ * @param[out] ev event description
+ * @return pointer to the next character after the value, NULL on errors
+ */
+static char* parse_input(char* pos, struct event* ev)
+{
+    const char* key;
+    size_t len;
+
+    pos = enter_object(pos);
+    if (!pos) {
+        return NULL;
+    }
+    while (pos && next_member(&pos, &key, &len)) {
+        if (KEY_IS(key, len, "xkb_active_layout_index")) {
+            get_int(pos, &pos, &ev->layout);
+        } else if (KEY_IS(key, len, "xkb_layout_names")) {
+            ev->layouts_num = get_array_size(pos, &pos);
+        } else if (KEY_IS(key, len, "identifier")) {
+            ev->input_id = get_string(pos, &pos);
+        } else if (KEY_IS(key, len, "type")) {
+            ev->input_type = get_string(pos, &pos);
+        } else {
+            pos = skip_value(pos);
+        }
+    }
+
+    return pos ? leave_object(pos) : NULL;
+}
+
+/**
+ * Parse "current" node of workspace event.
+ * @param[in] pos pointer to the value
+ * @param[out] ev event description
+ * @return pointer to the next character after the value, NULL on errors
+ */
+static char* parse_workspace(char* pos, struct event* ev)
+{
+    const char* key;
+    size_t len;
+
+    pos = enter_object(pos);
+    if (!pos) {
+        return NULL;
+    }
+    while (pos && next_member(&pos, &key, &len)) {
+        if (KEY_IS(key, len, "name")) {
+            ev->workspace = get_string(pos, &pos);
+        } else if (KEY_IS(key, len, "output")) {
+            ev->output = get_string(pos, &pos);
+        } else {
+            pos = skip_value(pos);
+        }
+    }
+
+    return pos ? leave_object(pos) : NULL;
+}
+
+bool event_parse(char* msg, uint32_t source, uint32_t mask, struct event* ev)
+{
+    const char* key;
+    size_t len;
+
+    ev->type = EVENT_NONE;
+    ev->wnd_id = -1;
+    ev->app_id = NULL;
+    ev->title = NULL;
+    ev->wnd_class = NULL;
+    ev->layout = -1;
+    ev->layouts_num = -1;
+    ev->input_id = NULL;
+    ev->input_type = NULL;
+    ev->workspace = NULL;
+    ev->output = NULL;
+
+    char* pos = enter_object(msg);
+    if (!pos) {
+        return false;
+    }
+
+    while (next_member(&pos, &key, &len)) {
+        if (KEY_IS(key, len, "change")) {
+            const char* change = get_string(pos, &pos);
+            if (change) {
+                for (size_t i = 0; i < sizeof(event_names) /
+                                        sizeof(event_names[0]); ++i) {
+                    if (event_names[i].source == source &&
+                        strcmp(change, event_names[i].name) == 0) {
+                        ev->type = event_names[i].type;
+                        break;
+                    }
+                }
+            }
+            if (!(mask & EVENT_MASK(ev->type))) {
+                ev->type = EVENT_NONE;
+                return pos != NULL; // irrelevant event, skip the rest
+            }
+        } else if (KEY_IS(key, len, "container")) {
+            pos = parse_container(pos, ev);
+        } else if (KEY_IS(key, len, "input")) {
+            pos = parse_input(pos, ev);
+        } else if (KEY_IS(key, len, "current") && *skip_ws(pos) == '{') {
+            pos = parse_workspace(pos, ev);
+        } else {
+            pos = skip_value(pos);
+        }
+        if (!pos) {
+            return false;
+        }
+    }
+
+    return leave_object(pos) != NULL;
+}
+
+bool event_subscription(uint32_t mask, char* buf, size_t size)
+{
+    const size_t types = sizeof(event_names) / sizeof(event_names[0]);
+    uint32_t sources = 0; // mask of already added IPC events
+    size_t len = 0;
+    int rc;
+
+    for (size_t i = 0; i < types; ++i) {
+        const uint32_t bit = 1u << event_names[i].source;
+        if ((mask & EVENT_MASK(event_names[i].type)) && !(sources & bit)) {
+            sources |= bit;
+            rc = snprintf(buf + len, size - len, "%s\"%s\"",
+                          len ? ", " : "[ ", event_names[i].subscribe);
+            if (rc < 0 || (size_t)rc >= size - len) {
+                return false;
+            }
+            len += rc;
+        }
+    }
+    rc = snprintf(buf + len, size - len, len ? " ]" : "[ ]");
+
+    return rc >= 0 && (size_t)rc < size - len;
+}
+
+bool reply_parse(char* msg, const char** error)
+{
+    const char* key;
+    size_t len;
+    bool success = true;
+
+    *error = NULL;
+
+    char* pos = skip_ws(msg);
+    if (*pos != '[') {
+        return false;
+    }
+    ++pos;
+
+    // array of command results: [ { "success": bool, "error": str }, ... ]
+    while (1) {
+        pos = skip_ws(pos);
+        if (*pos == ',') {
+            ++pos;
+        }
+        char* obj = enter_object(pos);
+        if (!obj) {
+            break;
+        }
+        pos = obj;
+        while (next_member(&pos, &key, &len)) {
+            if (KEY_IS(key, len, "success")) {
+                if (strncmp(pos, "true", 4) != 0) {
+                    success = false;
+                }
+                pos = skip_value(pos);
+            } else if (KEY_IS(key, len, "error")) {
+                const char* str = get_string(pos, &pos);
+                if (str && !*error) {
+                    *error = str;
+                }
+            } else {
+                pos = skip_value(pos);
+            }
+            if (!pos) {
+                return false;
+            }
+        }
+        pos = leave_object(pos);
+        if (!pos) {
+            return false;
+        }
+    }
+
+    return success && *pos == ']';
+}
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Types of events handled by the daemon (IPC event type and "change"). */
+enum event_type {
+    EVENT_NONE,   ///< Irrelevant event, not parsed
+    EVENT_FOCUS,  ///< Window: focus
+    EVENT_TITLE,  ///< Window: title
+    EVENT_CLOSE,  ///< Window: close
+    EVENT_LAYOUT, ///< Input: xkb_layout
+    EVENT_KEYMAP, ///< Input: xkb_keymap
+    EVENT_ADDED,  ///< Input: added
+    EVENT_REMOVED, ///< Input: removed
+    EVENT_WORKSPACE, ///< Workspace: focus
+    EVENT_TYPES
+};
+
+// Bit of the event type in the mask of handled events
+#define EVENT_MASK(type) (1u << (type))
+
+/** Event description: fields extracted from the IPC message. */
+struct event {
+    enum event_type type;
+    int wnd_id;         ///< container id, -1 if not present
+    const char* app_id; ///< application id, NULL if not present
+    const char* title;  ///< window title, NULL if not present
+    const char* wnd_class; ///< X11 window class, NULL if not present
+    int layout;         ///< active keyboard layout index, -1 if not present
+    int layouts_num;    ///< number of keyboard layouts, -1 if not present
+    const char* input_id;   ///< input device identifier, NULL if not present
+    const char* input_type; ///< input device type, NULL if not present
+    const char* workspace;  ///< workspace name, NULL if not present
+    const char* output;     ///< output of the workspace, NULL if not present
+};
+
+/**
+ * Parse IPC event message.
+ * Only fields used by the daemon are extracted, the rest of the message
+ * is skipped without parsing. Processing stops as soon as the event type is
+ * recognized as irrelevant or not handled.
+ * The message is modified in place: all extracted strings are unescaped
+ * and null-terminated inside the source buffer.
+ * @param[in] msg null-terminated JSON message
+ * @param[in] source IPC message type without the event bit
+ * @param[in] mask mask of handled event types, see EVENT_MASK
+ * @param[out] ev event description
+ * @return false if message is malformed
+ */
+bool event_parse(char* msg, uint32_t source, uint32_t mask, struct event* ev);
+
+/**
+ * Build payload of the subscribe request: list of IPC events that deliver
+ * handled event types, other events are not received at all.
+ * @param[in] mask mask of handled event types, see EVENT_MASK
+ * @param[out] buf destination buffer
+ * @param[in] size size of the buffer
+ * @return false if the buffer is too small
+ */
+bool event_subscription(uint32_t mask, char* buf, size_t size);
+
+/**
+ * Parse IPC command reply.
+ * The message is modified in place, see event_parse.
+ * @param[in] msg null-terminated JSON message
+ * @param[out] error description of the first error, NULL if not present
+ * @return true if all commands were successfully executed
+ */
+bool reply_parse(char* msg, const char** error);
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "hash.h"
+
+#include <string.h>
+
+/**
+ * Rotate bits left.
+ * @param[in] val source value
+ * @param[in] bits number of bits to rotate
+ * @return rotated value
+ */
+static inline uint64_t rotl64(uint64_t val, int bits)
+{
+    return (val << bits) | (val >> (64 - bits));
+}
+
+uint64_t str_hash(const char* str)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t hash, word;
+    size_t len;
+
+    if (!str) {
+        return 0;
+    }
+
+    len = strlen(str);
+    hash = len;
+    for (; len >= sizeof(word); len -= sizeof(word), str += sizeof(word)) {
+        memcpy(&word, str, sizeof(word));
+        hash ^= rotl64(word * c1, 31) * c2;
+        hash = rotl64(hash, 27) * 5 + 0x52dce729;
+    }
+    if (len) {
+        word = 0;
+        memcpy(&word, str, len);
+        hash ^= rotl64(word * c1, 31) * c2;
+    }
+
+    // finalizer
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
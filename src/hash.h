@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Get 64-bit hash of the string.
+ * The string is processed a word (8 bytes) at a time with the MurmurHash3
+ * block mixing and finalizer.
+ * @param[in] str source string, can be NULL
+ * @return hash, 0 for NULL
+ */
+uint64_t str_hash(const char* str);
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "inputs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Registered keyboards
+static struct keyboard* keyboards;
+static size_t keyboards_num;
+
+/**
+ * Find keyboard description.
+ * @param[in] id input device identifier
+ * @return pointer to the keyboard description or NULL if not found
+ */
+static struct keyboard* find_keyboard(const char* id)
+{
+    for (size_t i = 0; i < keyboards_num; ++i) {
+        struct keyboard* kbd = &keyboards[i];
+        if (strcmp(kbd->id, id) == 0) {
+            return kbd;
+        }
+    }
+    return NULL;
+}
+
+void put_keyboard(const char* id, int layouts, int layout)
+{
+    struct keyboard* kbd = find_keyboard(id);
+    if (kbd) {
+        if (layouts >= 0) {
+            kbd->layouts = layouts;
+        }
+        if (layout >= 0) {
+            kbd->layout = layout;
+        }
+        return;
+    }
+
+    const size_t len = strlen(id) + 1 /* last null */;
+    char* id_copy = malloc(len);
+    kbd = realloc(keyboards, (keyboards_num + 1) * sizeof(struct keyboard));
+    if (!id_copy || !kbd) {
+        fprintf(stderr, "Not enough memory\n");
+        free(id_copy);
+        if (kbd) {
+            keyboards = kbd;
+        }
+        return;
+    }
+    keyboards = kbd;
+    kbd = &keyboards[keyboards_num++];
+    memcpy(id_copy, id, len);
+    kbd->id = id_copy;
+    kbd->layouts = layouts;
+    kbd->layout = layout;
+}
+
+void rm_keyboard(const char* id)
+{
+    struct keyboard* kbd = find_keyboard(id);
+    if (kbd) {
+        free(kbd->id);
+        *kbd = keyboards[--keyboards_num];
+    }
+}
+
+bool keyboards_diverged(void)
+{
+    int layout = -1;
+    for (size_t i = 0; i < keyboards_num; ++i) {
+        const struct keyboard* kbd = &keyboards[i];
+        if (kbd->layouts > 1 && kbd->layout >= 0) {
+            if (layout < 0) {
+                layout = kbd->layout;
+            } else if (layout != kbd->layout) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+size_t get_keyboards(const struct keyboard** list)
+{
+    *list = keyboards;
+    return keyboards_num;
+}
+
+void clear_keyboards(void)
+{
+    for (size_t i = 0; i < keyboards_num; ++i) {
+        free(keyboards[i].id);
+    }
+    keyboards_num = 0;
+}
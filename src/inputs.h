@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Keyboard description. */
+struct keyboard {
+    char* id;    ///< input device identifier
+    int layouts; ///< number of layouts in the keymap
+    int layout;  ///< active layout index, -1 if unknown
+};
+
+/**
+ * Add keyboard to the registry or update existing one.
+ * @param[in] id input device identifier
+ * @param[in] layouts number of layouts in the keymap, -1 to keep current
+ * @param[in] layout active layout index, -1 to keep current
+ */
+void put_keyboard(const char* id, int layouts, int layout);
+
+/**
+ * Remove keyboard from the registry.
+ * @param[in] id input device identifier
+ */
+void rm_keyboard(const char* id);
+
+/**
+ * Remove all keyboards from the registry.
+ */
+void clear_keyboards(void);
+
+/**
+ * Check if switchable keyboards have different active layouts.
+ * @return true if at least two keyboards have different layouts
+ */
+bool keyboards_diverged(void);
+
+/**
+ * Get list of registered keyboards.
+ * @param[out] list pointer to the array of keyboards
+ * @return number of keyboards in the array
+ */
+size_t get_keyboards(const struct keyboard** list);
@@ -3,86 +3,912 @@
 
 #include "layouts.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/** State descriptor: window/tab and its layout. */
+// Minimal number of state descriptors in the pool
+#define POOL_MIN_SIZE 64
+// Minimal number of window descriptors in the pool
+#define WINDOWS_MIN_SIZE 16
+
+// Invalid (null) index of the descriptor, the first entry of pools is reserved
+#define NO_ENTRY 0
+
+// Storage file signature and format version
+#define FILE_MAGIC   "swaykbdd"
+#define FILE_VERSION 4
+
+/**
+ * State descriptor: window/tab and its layout.
+ * Each state is linked into two LRU lists: list of the window states and
+ * the global one, the most recently used states are at the list heads.
+ */
 struct state {
+    uint64_t tab;
     uint32_t window;
-    uint32_t tab;
-    int      layout;
+    int32_t  layout;
+    uint32_t next;     ///< next (older) state of the window or next free one
+    uint32_t prev;     ///< previous (newer) state of the same window
+    uint32_t lru_next; ///< next (older) state in the global LRU list
+    uint32_t lru_prev; ///< previous (newer) state in the global LRU list
+};
+
+/** Window descriptor: head of the list of window states and signature. */
+struct window {
+    uint32_t id;
+    uint32_t head;  ///< most recently used state or next free window
+    uint32_t tail;  ///< least recently used state of the window
+    uint32_t count; ///< number of states of the window
+    int32_t rule;   ///< layout defined by rules, RULE_UNKNOWN if not evaluated
+    uint32_t reserved;
+    uint64_t app;   ///< application id hash
+    uint64_t title; ///< window title hash
+};
+
+/**
+ * Storage header.
+ * The storage is a single memory block: header, pool of windows and pool of
+ * states. In persistent mode the block is mapped to the file, so all changes
+ * are written to the file in place.
+ */
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t windows_sz; ///< size of the windows pool
+    uint32_t states_sz;  ///< size of the states pool
+    uint32_t lru_head;   ///< most recently used state
+    uint32_t lru_tail;   ///< least recently used state
+    uint32_t reserved;
 };
+
+/** Hash table (open addressing) of pool indices, twice as big as the pool. */
+struct index {
+    uint32_t* slots;
+    uint32_t size;
+};
+
+/** Get hash of the pool entry. */
+typedef uint32_t (*entry_hash)(uint32_t idx);
+
+// Storage block and its file (-1 if storage is not persistent)
+static struct header* storage;
+static size_t storage_size;
+static int storage_fd = -1;
+
+// Pool of window descriptors, index 0 is reserved as NO_ENTRY
+static struct window* windows;
+static uint32_t windows_free;
+static uint32_t windows_num;
+static struct index windows_map;
+
+// Pool of state descriptors, index 0 is reserved as NO_ENTRY
 static struct state* states;
-static int states_sz;
+static uint32_t states_free;
+static uint32_t states_num;
+static struct index states_map;
+
+// Limits of the number of states: per window and total, 0 for unlimited
+static size_t limit_window;
+static size_t limit_total;
+static size_t evictions;
+
+// Number of successful and failed lookups
+static size_t hits;
+static size_t misses;
+
+// Number of heap allocations made by the storage
+static size_t allocs;
+
+/**
+ * Mix bits of the integer value (murmur3 finalizer).
+ * @param[in] val source value
+ * @return hash
+ */
+static uint32_t mix32(uint32_t val)
+{
+    val ^= val >> 16;
+    val *= 0x85ebca6b;
+    val ^= val >> 13;
+    val *= 0xc2b2ae35;
+    val ^= val >> 16;
+    return val;
+}
+
+/**
+ * Get hash of the state key.
+ * @param[in] window window id
+ * @param[in] tab subwindow (tab) id
+ * @return hash
+ */
+static uint32_t state_hash(uint32_t window, uint64_t tab)
+{
+    return mix32((window * 0x9e3779b1) ^ (uint32_t)tab ^
+                 (uint32_t)(tab >> 32));
+}
+
+/** Get hash of the state descriptor, see entry_hash for details. */
+static uint32_t state_entry_hash(uint32_t idx)
+{
+    return state_hash(states[idx].window, states[idx].tab);
+}
+
+/** Get hash of the window descriptor, see entry_hash for details. */
+static uint32_t window_entry_hash(uint32_t idx)
+{
+    return mix32(windows[idx].id);
+}
+
+/**
+ * Get hash of the window signature.
+ * @param[in] app application id hash
+ * @param[in] title window title hash
+ * @return hash
+ */
+static uint32_t signature_hash(uint64_t app, uint64_t title)
+{
+    return mix32((uint32_t)app ^ (uint32_t)(app >> 32) ^
+                 ((uint32_t)title * 0x9e3779b1) ^ (uint32_t)(title >> 32));
+}
+
+/** Get hash of the window signature, see entry_hash for details. */
+static uint32_t signature_entry_hash(uint32_t idx)
+{
+    return signature_hash(windows[idx].app, windows[idx].title);
+}
+
+/**
+ * Round up the number to the nearest power of 2.
+ * @param[in] val source value
+ * @param[in] min minimal result value (power of 2)
+ * @return rounded value
+ */
+static uint32_t round_pow2(size_t val, uint32_t min)
+{
+    uint32_t res = min;
+    while (res < val) {
+        res <<= 1;
+    }
+    return res;
+}
+
+/**
+ * Insert pool index into the hash table.
+ * @param[in] index hash table
+ * @param[in] idx pool index to insert
+ * @param[in] hash hash of the pool entry
+ */
+static void index_insert(struct index* index, uint32_t idx, uint32_t hash)
+{
+    const uint32_t mask = index->size - 1;
+    uint32_t pos = hash & mask;
+    while (index->slots[pos] != NO_ENTRY) {
+        pos = (pos + 1) & mask;
+    }
+    index->slots[pos] = idx;
+}
+
+/**
+ * Remove slot from the hash table (backward shift deletion).
+ * @param[in] index hash table
+ * @param[in] pos index of the slot to remove
+ * @param[in] hash function to get hash of the pool entry
+ */
+static void index_remove(struct index* index, uint32_t pos, entry_hash hash)
+{
+    const uint32_t mask = index->size - 1;
+    uint32_t next = pos;
+
+    index->slots[pos] = NO_ENTRY;
+
+    while (1) {
+        next = (next + 1) & mask;
+        if (index->slots[next] == NO_ENTRY) {
+            break;
+        }
+        const uint32_t home = hash(index->slots[next]) & mask;
+        if (((next - home) & mask) >= ((next - pos) & mask)) {
+            index->slots[pos] = index->slots[next];
+            index->slots[next] = NO_ENTRY;
+            pos = next;
+        }
+    }
+}
+
+/**
+ * Allocate empty hash table for the pool.
+ * @param[in] index hash table
+ * @param[in] pool_sz size of the pool
+ * @return false if not enough memory
+ */
+static bool index_reset(struct index* index, uint32_t pool_sz)
+{
+    uint32_t* slots = calloc(pool_sz * 2, sizeof(uint32_t));
+    if (!slots) {
+        fprintf(stderr, "Not enough memory\n");
+        return false;
+    }
+    ++allocs;
+    free(index->slots);
+    index->slots = slots;
+    index->size = pool_sz * 2;
+    return true;
+}
 
 /**
- * Find state description for specified window key.
+ * Find slot in the states hash table.
  * @param[in] window window id
  * @param[in] tab subwindow (tab) id
- * @return pointer to the state descriptor or NULL if not found
+ * @return index of the slot with the state or the empty slot to insert
  */
-static struct state* find_state(uint32_t window, uint32_t tab)
+static uint32_t find_state(uint32_t window, uint64_t tab)
 {
-    for (int i = 0; i < states_sz; ++i) {
-        struct state* entry = &states[i];
+    const uint32_t mask = states_map.size - 1;
+    uint32_t pos = state_hash(window, tab) & mask;
+    while (states_map.slots[pos] != NO_ENTRY) {
+        const struct state* entry = &states[states_map.slots[pos]];
         if (entry->window == window && entry->tab == tab) {
-            return entry;
+            break;
         }
+        pos = (pos + 1) & mask;
     }
-    return NULL;
+    return pos;
 }
 
-int get_layout(uint32_t window, uint32_t tab)
+/**
+ * Find slot in the windows hash table.
+ * @param[in] id window id
+ * @return index of the slot with the window or the empty slot to insert
+ */
+static uint32_t find_window(uint32_t id)
 {
-    const struct state* entry = find_state(window, tab);
-    return entry ? entry->layout : INVALID_LAYOUT;
+    const uint32_t mask = windows_map.size - 1;
+    uint32_t pos = mix32(id) & mask;
+    while (windows_map.slots[pos] != NO_ENTRY &&
+           windows[windows_map.slots[pos]].id != id) {
+        pos = (pos + 1) & mask;
+    }
+    return pos;
 }
 
-void put_layout(uint32_t window, uint32_t tab, int layout)
+/**
+ * Rebuild free lists and hash tables from the pools, LRU lists are kept.
+ * @return false if not enough memory
+ */
+static bool rebuild(void)
 {
-    // search for existing descriptor
-    struct state* entry = find_state(window, tab);
-    if (entry) {
-        entry->layout = layout;
-        return;
+    if (!index_reset(&windows_map, storage->windows_sz) ||
+        !index_reset(&states_map, storage->states_sz)) {
+        return false;
     }
 
-    // search for free descriptor
-    for (int i = 0; i < states_sz; ++i) {
-        struct state* entry = &states[i];
-        if (entry->window == 0 && entry->tab == 0) {
-            entry->window = window;
-            entry->tab = tab;
-            entry->layout = layout;
-            return;
+    windows_free = NO_ENTRY;
+    windows_num = 0;
+    for (uint32_t i = storage->windows_sz - 1; i != NO_ENTRY; --i) {
+        if (windows[i].id) {
+            index_insert(&windows_map, i, window_entry_hash(i));
+            ++windows_num;
+        } else {
+            windows[i].head = windows_free;
+            windows_free = i;
         }
     }
 
-    // realloc
-    const int old_sz = states_sz;
-    states_sz += 8;
-    states = realloc(states, states_sz * sizeof(struct state));
-    for (int i = old_sz; i < states_sz; ++i) {
-        struct state* entry = &states[i];
-        if (i == old_sz) {
-            entry->window = window;
-            entry->tab = tab;
-            entry->layout = layout;
+    states_free = NO_ENTRY;
+    states_num = 0;
+    for (uint32_t i = storage->states_sz - 1; i != NO_ENTRY; --i) {
+        if (states[i].window) {
+            index_insert(&states_map, i, state_entry_hash(i));
+            ++states_num;
         } else {
-            entry->window = 0;
-            entry->tab = 0;
-            entry->layout = INVALID_LAYOUT;
+            states[i].next = states_free;
+            states_free = i;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check links of the loaded storage against the rebuilt hash tables.
+ * Each used state must be reachable exactly once from the global LRU list
+ * and from the list of its window, all indices must be inside the pools.
+ * @return false if the storage is inconsistent
+ */
+static bool check_storage(void)
+{
+    const uint32_t states_sz = storage->states_sz;
+    uint32_t total = 0;
+    uint32_t prev, idx, num;
+
+    for (uint32_t i = 1; i < storage->windows_sz; ++i) {
+        const struct window* wnd = &windows[i];
+        if (!wnd->id) {
+            continue;
+        }
+        if (windows_map.slots[find_window(wnd->id)] != i) {
+            return false; // duplicate window id
+        }
+        prev = NO_ENTRY;
+        num = 0;
+        for (idx = wnd->head; idx != NO_ENTRY; idx = states[idx].next) {
+            if (idx >= states_sz || num >= wnd->count ||
+                states[idx].window != wnd->id || states[idx].prev != prev) {
+                return false;
+            }
+            prev = idx;
+            ++num;
+        }
+        if (num != wnd->count || wnd->tail != prev) {
+            return false;
+        }
+        total += num;
+    }
+    if (total != states_num) {
+        return false; // states without window
+    }
+
+    prev = NO_ENTRY;
+    num = 0;
+    for (idx = storage->lru_head; idx != NO_ENTRY; idx = states[idx].lru_next) {
+        if (idx >= states_sz || num >= states_num || !states[idx].window ||
+            states[idx].lru_prev != prev ||
+            states_map.slots[find_state(states[idx].window, states[idx].tab)] !=
+                idx) {
+            return false;
+        }
+        prev = idx;
+        ++num;
+    }
+
+    return num == states_num && storage->lru_tail == prev;
+}
+
+/**
+ * Resize the storage block, existing descriptors keep their indices.
+ * @param[in] windows_sz new size of the windows pool
+ * @param[in] states_sz new size of the states pool
+ * @return false on errors
+ */
+static bool resize_storage(uint32_t windows_sz, uint32_t states_sz)
+{
+    const uint32_t old_windows_sz = storage ? storage->windows_sz : 0;
+    const uint32_t old_states_sz = storage ? storage->states_sz : 0;
+    const size_t size = sizeof(struct header) +
+        windows_sz * sizeof(struct window) + states_sz * sizeof(struct state);
+    struct header* block;
+
+    if (storage_fd == -1) {
+        block = realloc(storage, size);
+        if (!block) {
+            fprintf(stderr, "Not enough memory\n");
+            return false;
+        }
+    } else {
+        block = MAP_FAILED;
+        if (ftruncate(storage_fd, size) != -1) {
+            block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         storage_fd, 0);
+        }
+        if (block == MAP_FAILED) {
+            const int ec = errno;
+            fprintf(stderr, "Unable to resize storage file: [%i] %s\n", ec,
+                    strerror(ec));
+            return false;
+        }
+        if (storage) {
+            munmap(storage, storage_size);
+        }
+    }
+    ++allocs;
+
+    if (!storage) {
+        memcpy(block->magic, FILE_MAGIC, sizeof(block->magic));
+        block->version = FILE_VERSION;
+        block->lru_head = NO_ENTRY;
+        block->lru_tail = NO_ENTRY;
+        block->reserved = 0;
+    }
+    storage = block;
+    storage_size = size;
+
+    // move states behind the extended windows pool, then clear new entries
+    windows = (struct window*)(storage + 1);
+    states = (struct state*)(windows + windows_sz);
+    memmove(states, windows + old_windows_sz,
+            old_states_sz * sizeof(struct state));
+    memset(windows + old_windows_sz, 0,
+           (windows_sz - old_windows_sz) * sizeof(struct window));
+    memset(states + old_states_sz, 0,
+           (states_sz - old_states_sz) * sizeof(struct state));
+    storage->windows_sz = windows_sz;
+    storage->states_sz = states_sz;
+
+    return rebuild();
+}
+
+/**
+ * Open storage file and map its content.
+ * @param[in] path path to the storage file
+ * @return false on errors
+ */
+static bool load_storage(const char* path)
+{
+    struct stat st;
+
+    storage_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (storage_fd == -1 || fstat(storage_fd, &st) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to open storage file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        return false;
+    }
+    if (flock(storage_fd, LOCK_EX | LOCK_NB) == -1) {
+        // another instance owns the file, don't corrupt its state
+        const int ec = errno;
+        fprintf(stderr,
+                "Unable to lock storage file %s: [%i] %s, "
+                "layouts are not persistent\n",
+                path, ec, strerror(ec));
+        close(storage_fd);
+        storage_fd = -1;
+        return true;
+    }
+    if ((size_t)st.st_size < sizeof(struct header)) {
+        return true; // new file
+    }
+
+    struct header* block = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, storage_fd, 0);
+    if (block == MAP_FAILED) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to map storage file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        return false;
+    }
+    if (memcmp(block->magic, FILE_MAGIC, sizeof(block->magic)) != 0 ||
+        block->version != FILE_VERSION || block->windows_sz == 0 ||
+        block->states_sz == 0 ||
+        (size_t)st.st_size != sizeof(struct header) +
+            (size_t)block->windows_sz * sizeof(struct window) +
+            (size_t)block->states_sz * sizeof(struct state)) {
+        fprintf(stderr, "Invalid storage file %s, reset\n", path);
+        munmap(block, st.st_size);
+        return true;
+    }
+
+    storage = block;
+    storage_size = st.st_size;
+    windows = (struct window*)(storage + 1);
+    states = (struct state*)(windows + storage->windows_sz);
+
+    if (!rebuild()) {
+        return false;
+    }
+    if (!check_storage()) {
+        fprintf(stderr, "Inconsistent storage file %s, reset\n", path);
+        munmap(storage, storage_size);
+        storage = NULL;
+        storage_size = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Get window descriptor, create new one if it doesn't exist.
+ * @param[in] id window id
+ * @return index of the window descriptor, NO_ENTRY on errors
+ */
+static uint32_t add_window(uint32_t id)
+{
+    uint32_t pos = find_window(id);
+    if (windows_map.slots[pos] != NO_ENTRY) {
+        return windows_map.slots[pos];
+    }
+
+    if (windows_free == NO_ENTRY) {
+        if (!resize_storage(storage->windows_sz * 2, storage->states_sz)) {
+            return NO_ENTRY;
         }
+        pos = find_window(id);
+    }
+
+    const uint32_t idx = windows_free;
+    struct window* wnd = &windows[idx];
+    windows_free = wnd->head;
+    wnd->id = id;
+    wnd->head = NO_ENTRY;
+    wnd->tail = NO_ENTRY;
+    wnd->count = 0;
+    wnd->rule = RULE_UNKNOWN;
+    wnd->app = 0;
+    wnd->title = 0;
+    windows_map.slots[pos] = idx;
+    ++windows_num;
+
+    return idx;
+}
+
+/**
+ * Get window descriptor of the state.
+ * @param[in] entry state descriptor
+ * @return pointer to the window descriptor
+ */
+static struct window* state_window(const struct state* entry)
+{
+    return &windows[windows_map.slots[find_window(entry->window)]];
+}
+
+/**
+ * Link the state to the heads of LRU lists.
+ * @param[in] wnd window descriptor
+ * @param[in] idx index of the state descriptor
+ */
+static void link_state(struct window* wnd, uint32_t idx)
+{
+    struct state* entry = &states[idx];
+
+    entry->prev = NO_ENTRY;
+    entry->next = wnd->head;
+    if (wnd->head != NO_ENTRY) {
+        states[wnd->head].prev = idx;
+    } else {
+        wnd->tail = idx;
+    }
+    wnd->head = idx;
+    ++wnd->count;
+
+    entry->lru_prev = NO_ENTRY;
+    entry->lru_next = storage->lru_head;
+    if (storage->lru_head != NO_ENTRY) {
+        states[storage->lru_head].lru_prev = idx;
+    } else {
+        storage->lru_tail = idx;
+    }
+    storage->lru_head = idx;
+}
+
+/**
+ * Unlink the state from LRU lists.
+ * @param[in] wnd window descriptor
+ * @param[in] idx index of the state descriptor
+ */
+static void unlink_state(struct window* wnd, uint32_t idx)
+{
+    const struct state* entry = &states[idx];
+
+    if (entry->prev != NO_ENTRY) {
+        states[entry->prev].next = entry->next;
+    } else {
+        wnd->head = entry->next;
+    }
+    if (entry->next != NO_ENTRY) {
+        states[entry->next].prev = entry->prev;
+    } else {
+        wnd->tail = entry->prev;
+    }
+    --wnd->count;
+
+    if (entry->lru_prev != NO_ENTRY) {
+        states[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        storage->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NO_ENTRY) {
+        states[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        storage->lru_tail = entry->lru_prev;
+    }
+}
+
+/**
+ * Release the state descriptor.
+ * @param[in] wnd window descriptor
+ * @param[in] idx index of the state descriptor
+ */
+static void free_state(struct window* wnd, uint32_t idx)
+{
+    struct state* entry = &states[idx];
+
+    unlink_state(wnd, idx);
+    index_remove(&states_map, find_state(entry->window, entry->tab),
+                 state_entry_hash);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->layout = INVALID_LAYOUT;
+    entry->next = states_free;
+    states_free = idx;
+    --states_num;
+}
+
+bool init_layouts(size_t capacity, const char* file)
+{
+    uint32_t windows_sz = round_pow2(capacity / 4, WINDOWS_MIN_SIZE);
+    uint32_t states_sz = round_pow2(capacity + 1, POOL_MIN_SIZE);
+
+    if (file && !load_storage(file)) {
+        return false;
+    }
+    if (storage) {
+        reset_window_rules(); // rules could be changed since the last run
+        if (storage->windows_sz >= windows_sz &&
+            storage->states_sz >= states_sz) {
+            return true;
+        }
+        if (windows_sz < storage->windows_sz) {
+            windows_sz = storage->windows_sz;
+        }
+        if (states_sz < storage->states_sz) {
+            states_sz = storage->states_sz;
+        }
+    }
+
+    return resize_storage(windows_sz, states_sz);
+}
+
+void set_layouts_limits(size_t per_window, size_t total)
+{
+    limit_window = per_window;
+    limit_total = total;
+}
+
+void get_layouts_stats(struct layouts_stats* stats)
+{
+    stats->windows = windows_num;
+    stats->entries = states_num;
+    stats->capacity = storage ? storage->states_sz - 1 : 0;
+    stats->evictions = evictions;
+    stats->hits = hits;
+    stats->misses = misses;
+    stats->bytes = storage_size +
+        (windows_map.size + states_map.size) * sizeof(uint32_t);
+    stats->allocs = allocs;
+}
+
+int get_layout(uint32_t window, uint64_t tab)
+{
+    if (!storage) {
+        return INVALID_LAYOUT;
+    }
+    const uint32_t idx = states_map.slots[find_state(window, tab)];
+    if (idx == NO_ENTRY) {
+        ++misses;
+        return INVALID_LAYOUT;
+    }
+    ++hits;
+
+    struct state* entry = &states[idx];
+    if (storage->lru_head != idx) {
+        struct window* wnd = state_window(entry);
+        unlink_state(wnd, idx);
+        link_state(wnd, idx);
+    }
+
+    return entry->layout;
+}
+
+int peek_layout(uint32_t window, uint64_t* tab)
+{
+    if (!storage) {
+        return INVALID_LAYOUT;
+    }
+    const uint32_t wnd_idx = windows_map.slots[find_window(window)];
+    if (wnd_idx == NO_ENTRY || windows[wnd_idx].head == NO_ENTRY) {
+        return INVALID_LAYOUT;
+    }
+    const struct state* entry = &states[windows[wnd_idx].head];
+    if (tab) {
+        *tab = entry->tab;
+    }
+    return entry->layout;
+}
+
+void put_layout(uint32_t window, uint64_t tab, int layout)
+{
+    if (!storage) {
+        return;
+    }
+
+    // search for existing descriptor
+    const uint32_t pos = find_state(window, tab);
+    if (states_map.slots[pos] != NO_ENTRY) {
+        const uint32_t idx = states_map.slots[pos];
+        struct window* wnd = state_window(&states[idx]);
+        states[idx].layout = layout;
+        unlink_state(wnd, idx);
+        link_state(wnd, idx);
+        return;
+    }
+
+    const uint32_t wnd_idx = add_window(window);
+    if (wnd_idx == NO_ENTRY) {
+        return;
     }
+
+    // evict least recently used states
+    if (limit_window && windows[wnd_idx].count >= limit_window) {
+        free_state(&windows[wnd_idx], windows[wnd_idx].tail);
+        ++evictions;
+    }
+    if (limit_total && states_num >= limit_total) {
+        const uint32_t lru = storage->lru_tail;
+        free_state(state_window(&states[lru]), lru);
+        ++evictions;
+    }
+
+    // get free descriptor
+    if (states_free == NO_ENTRY &&
+        !resize_storage(storage->windows_sz, storage->states_sz * 2)) {
+        return;
+    }
+    const uint32_t idx = states_free;
+    struct state* entry = &states[idx];
+    states_free = entry->next;
+
+    entry->window = window;
+    entry->tab = tab;
+    entry->layout = layout;
+    link_state(&windows[wnd_idx], idx);
+    index_insert(&states_map, idx, state_hash(window, tab));
+    ++states_num;
 }
 
 void rm_layout(uint32_t window)
 {
-    for (int i = 0; i < states_sz; ++i) {
-        struct state* entry = &states[i];
-        if (entry->window == window) {
-            entry->window = 0;
-            entry->tab = 0;
-            entry->layout = INVALID_LAYOUT;
+    if (!storage) {
+        return;
+    }
+    const uint32_t pos = find_window(window);
+    const uint32_t wnd_idx = windows_map.slots[pos];
+    if (wnd_idx == NO_ENTRY) {
+        return;
+    }
+
+    struct window* wnd = &windows[wnd_idx];
+    while (wnd->head != NO_ENTRY) {
+        free_state(wnd, wnd->head);
+    }
+
+    index_remove(&windows_map, pos, window_entry_hash);
+    memset(wnd, 0, sizeof(*wnd));
+    wnd->head = windows_free;
+    windows_free = wnd_idx;
+    --windows_num;
+}
+
+void put_window_info(uint32_t window, uint64_t app, uint64_t title)
+{
+    if (storage) {
+        const uint32_t idx = add_window(window);
+        if (idx != NO_ENTRY) {
+            windows[idx].app = app;
+            windows[idx].title = title;
+        }
+    }
+}
+
+int get_window_rule(uint32_t window)
+{
+    if (!storage) {
+        return INVALID_LAYOUT;
+    }
+    const uint32_t idx = windows_map.slots[find_window(window)];
+    return idx == NO_ENTRY ? RULE_UNKNOWN : windows[idx].rule;
+}
+
+void put_window_rule(uint32_t window, int layout)
+{
+    if (storage) {
+        const uint32_t idx = add_window(window);
+        if (idx != NO_ENTRY) {
+            windows[idx].rule = layout;
+        }
+    }
+}
+
+void reset_window_rules(void)
+{
+    if (storage) {
+        for (uint32_t i = 1; i < storage->windows_sz; ++i) {
+            windows[i].rule = RULE_UNKNOWN;
+        }
+    }
+}
+
+void restore_layouts(const struct window_info* list, size_t num)
+{
+    if (!storage || windows_num == 0) {
+        return;
+    }
+
+    // unmatched windows by signature (application and title)
+    struct index signatures = { NULL, 0 };
+
+    // new ids of stored windows, 0 for windows that don't exist anymore
+    uint32_t* ids = calloc(storage->windows_sz, sizeof(uint32_t));
+    bool* matched = calloc(num + 1, sizeof(bool));
+    if (!ids || !matched) {
+        fprintf(stderr, "Not enough memory\n");
+        free(ids);
+        free(matched);
+        return;
+    }
+
+    // match by container id and application
+    for (size_t i = 0; i < num; ++i) {
+        const uint32_t idx = windows_map.slots[find_window(list[i].id)];
+        if (idx != NO_ENTRY && windows[idx].app == list[i].app) {
+            ids[idx] = list[i].id;
+            matched[i] = true;
+        }
+    }
+
+    // match the rest by application and title
+    if (index_reset(&signatures, storage->windows_sz)) {
+        for (uint32_t idx = 1; idx < storage->windows_sz; ++idx) {
+            if (windows[idx].id && !ids[idx]) {
+                index_insert(&signatures, idx, signature_entry_hash(idx));
+            }
+        }
+        const uint32_t mask = signatures.size - 1;
+        for (size_t i = 0; i < num; ++i) {
+            if (matched[i]) {
+                continue;
+            }
+            uint32_t pos = signature_hash(list[i].app, list[i].title) & mask;
+            while (signatures.slots[pos] != NO_ENTRY) {
+                const uint32_t idx = signatures.slots[pos];
+                if (windows[idx].app == list[i].app &&
+                    windows[idx].title == list[i].title) {
+                    ids[idx] = list[i].id;
+                    index_remove(&signatures, pos, signature_entry_hash);
+                    break;
+                }
+                pos = (pos + 1) & mask;
+            }
+        }
+        free(signatures.slots);
+    }
+
+    // remove windows that don't exist anymore
+    for (uint32_t idx = 1; idx < storage->windows_sz; ++idx) {
+        if (windows[idx].id && !ids[idx]) {
+            rm_layout(windows[idx].id);
+        }
+    }
+
+    // apply new ids, hash tables are rebuilt after that
+    for (uint32_t idx = 1; idx < storage->windows_sz; ++idx) {
+        struct window* wnd = &windows[idx];
+        if (wnd->id && wnd->id != ids[idx]) {
+            wnd->id = ids[idx];
+            for (uint32_t st = wnd->head; st != NO_ENTRY;
+                 st = states[st].next) {
+                states[st].window = wnd->id;
+            }
+        }
+    }
+
+    free(ids);
+    free(matched);
+
+    rebuild();
+}
+
+void walk_layouts(layouts_visitor fn, void* data)
+{
+    if (storage) {
+        for (uint32_t idx = storage->lru_head; idx != NO_ENTRY;
+             idx = states[idx].lru_next) {
+            const struct state* entry = &states[idx];
+            fn(entry->window, entry->tab, entry->layout, data);
         }
     }
 }
@@ -3,9 +3,54 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define INVALID_LAYOUT -1
+// Rules were not evaluated for the window yet, see get_window_rule
+#define RULE_UNKNOWN -2
+
+/** Storage statistics. */
+struct layouts_stats {
+    size_t windows;   ///< number of windows with stored layouts
+    size_t entries;   ///< number of stored window/tab states
+    size_t capacity;  ///< number of preallocated state descriptors
+    size_t evictions; ///< number of states evicted due to limits
+    size_t hits;      ///< number of successful lookups
+    size_t misses;    ///< number of lookups without stored layout
+    size_t bytes;     ///< memory used by the storage
+    size_t allocs;    ///< number of heap allocations made by the storage
+};
+
+/** Window description used to restore the storage. */
+struct window_info {
+    uint32_t id;    ///< window id
+    uint64_t app;   ///< application id hash
+    uint64_t title; ///< window title hash
+};
+
+/**
+ * Preallocate storage, no allocations are made until it is filled.
+ * @param[in] capacity number of window/tab states to reserve
+ * @param[in] file path to the file to keep the storage in, NULL to use memory
+ * @return false on errors
+ */
+bool init_layouts(size_t capacity, const char* file);
+
+/**
+ * Set limits of the number of stored states.
+ * When a limit is reached, the least recently used state is evicted.
+ * @param[in] per_window max number of states (tabs) per window, 0 = no limit
+ * @param[in] total max number of states in the storage, 0 = no limit
+ */
+void set_layouts_limits(size_t per_window, size_t total);
+
+/**
+ * Get storage statistics.
+ * @param[out] stats statistics
+ */
+void get_layouts_stats(struct layouts_stats* stats);
 
 /**
  * Get layout information for specified window.
@@ -13,7 +58,16 @@
  * @param[in] tab subwindow (tab) id
  * @return layout index, INVALID_LAYOUT if not found
  */
-int get_layout(uint32_t window, uint32_t tab);
+int get_layout(uint32_t window, uint64_t tab);
+
+/**
+ * Get layout of the most recently used state of the window.
+ * Unlike get_layout, doesn't update LRU lists and statistics.
+ * @param[in] window window id
+ * @param[out] tab subwindow (tab) id of the state, can be NULL
+ * @return layout index, INVALID_LAYOUT if not found
+ */
+int peek_layout(uint32_t window, uint64_t* tab);
 
 /**
  * Put layout information into storage.
@@ -21,10 +75,65 @@ int get_layout(uint32_t window, uint32_t tab);
  * @param[in] tab subwindow (tab) id
  * @param[in] layout keyboard layout index
  */
-void put_layout(uint32_t window, uint32_t tab, int layout);
+void put_layout(uint32_t window, uint64_t tab, int layout);
 
 /**
  * Remove layout information from storage.
  * @param[in] window window id
  */
 void rm_layout(uint32_t window);
+
+/**
+ * Set window signature used to identify the window after restart.
+ * @param[in] window window id
+ * @param[in] app application id hash
+ * @param[in] title window title hash
+ */
+void put_window_info(uint32_t window, uint64_t app, uint64_t title);
+
+/**
+ * Get layout defined for the window by rules (cached result of evaluation).
+ * @param[in] window window id
+ * @return layout index, INVALID_LAYOUT if no rule matched the window,
+ *         RULE_UNKNOWN if rules were not evaluated for the window
+ */
+int get_window_rule(uint32_t window);
+
+/**
+ * Cache layout defined for the window by rules.
+ * @param[in] window window id
+ * @param[in] layout layout index, INVALID_LAYOUT if no rule matched
+ */
+void put_window_rule(uint32_t window, int layout);
+
+/**
+ * Forget cached results of rules evaluation for all windows.
+ */
+void reset_window_rules(void);
+
+/**
+ * Reconcile the storage with the list of currently existing windows.
+ * Stored windows are matched by id and application, the rest of them by
+ * application and title. Layouts of unmatched windows are removed.
+ * @param[in] list array of existing windows
+ * @param[in] num number of entries in the array
+ */
+void restore_layouts(const struct window_info* list, size_t num);
+
+/**
+ * Callback function: Stored state visitor.
+ * @param[in] window window id
+ * @param[in] tab subwindow (tab) id
+ * @param[in] layout keyboard layout index
+ * @param[in] data user data passed to walk_layouts
+ */
+typedef void (*layouts_visitor)(uint32_t window, uint64_t tab, int layout,
+                                void* data);
+
+/**
+ * Enumerate all stored states, most recently used first.
+ * The storage must not be modified by the visitor.
+ * @param[in] fn visitor callback
+ * @param[in] data user data to pass to the callback
+ */
+void walk_layouts(layouts_visitor fn, void* data);
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "loop.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+// Max number of watched file descriptors (including timers)
+#define MAX_HANDLERS 64
+// Max number of handled signals
+#define MAX_SIGNALS 8
+// Max number of events handled per iteration
+#define MAX_EVENTS 16
+
+/** File descriptor handler. */
+struct handler {
+    int fd;                 ///< file descriptor, -1 if the slot is free
+    loop_fd_cb fd_cb;       ///< callback for generic descriptors
+    loop_timer_cb timer_cb; ///< callback for timers
+    void* data;             ///< user data
+};
+
+/** Signal handler. */
+struct signal_handler {
+    int signum;
+    loop_signal_cb cb;
+};
+
+static int epoll_fd = -1;
+static struct handler handlers[MAX_HANDLERS];
+
+static int signal_fd = -1;
+static sigset_t signal_mask;
+static struct signal_handler signals[MAX_SIGNALS];
+static size_t signals_num;
+
+static bool running;
+static int stop_rc;
+
+/**
+ * Register new handler.
+ * @param[in] fd file descriptor
+ * @param[in] events epoll events to watch
+ * @return pointer to the handler or NULL on errors
+ */
+static struct handler* add_handler(int fd, uint32_t events)
+{
+    struct handler* hdl = NULL;
+    for (size_t i = 0; i < MAX_HANDLERS; ++i) {
+        if (handlers[i].fd == -1) {
+            hdl = &handlers[i];
+            break;
+        }
+    }
+    if (!hdl) {
+        fprintf(stderr, "Too many file descriptors in the main loop\n");
+        return NULL;
+    }
+
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = hdl,
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to add descriptor to the main loop: "
+                        "[%i] %s\n", ec, strerror(ec));
+        return NULL;
+    }
+
+    memset(hdl, 0, sizeof(*hdl));
+    hdl->fd = fd;
+
+    return hdl;
+}
+
+/**
+ * Find handler of the file descriptor.
+ * @param[in] fd file descriptor
+ * @return pointer to the handler or NULL if not found
+ */
+static struct handler* find_handler(int fd)
+{
+    for (size_t i = 0; i < MAX_HANDLERS; ++i) {
+        if (handlers[i].fd == fd) {
+            return &handlers[i];
+        }
+    }
+    return NULL;
+}
+
+/** Signal file descriptor handler, see loop_fd_cb for details. */
+static int on_signal(int fd, uint32_t events, void* data)
+{
+    struct signalfd_siginfo si;
+
+    (void)events;
+    (void)data;
+
+    while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+        for (size_t i = 0; i < signals_num; ++i) {
+            if (signals[i].signum == (int)si.ssi_signo) {
+                const int rc = signals[i].cb(si.ssi_signo);
+                if (rc) {
+                    return rc;
+                }
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int loop_init(void)
+{
+    for (size_t i = 0; i < MAX_HANDLERS; ++i) {
+        handlers[i].fd = -1;
+    }
+    sigemptyset(&signal_mask);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to create epoll: [%i] %s\n", ec,
+                strerror(ec));
+        return ec;
+    }
+
+    return 0;
+}
+
+int loop_add(int fd, uint32_t events, loop_fd_cb cb, void* data)
+{
+    struct handler* hdl = add_handler(fd, events);
+    if (!hdl) {
+        return EIO;
+    }
+    hdl->fd_cb = cb;
+    hdl->data = data;
+    return 0;
+}
+
+int loop_modify(int fd, uint32_t events)
+{
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = find_handler(fd),
+    };
+    if (!ev.data.ptr) {
+        return ENOENT;
+    }
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to modify descriptor in the main loop: "
+                        "[%i] %s\n", ec, strerror(ec));
+        return ec;
+    }
+    return 0;
+}
+
+void loop_remove(int fd)
+{
+    struct handler* hdl = find_handler(fd);
+    if (hdl) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        hdl->fd = -1;
+    }
+}
+
+int loop_timer(loop_timer_cb cb, void* data)
+{
+    const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to create timer: [%i] %s\n", ec,
+                strerror(ec));
+        return -ec;
+    }
+
+    struct handler* hdl = add_handler(fd, EPOLLIN);
+    if (!hdl) {
+        close(fd);
+        return -EIO;
+    }
+    hdl->timer_cb = cb;
+    hdl->data = data;
+
+    return fd;
+}
+
+void loop_timer_set(int timer, size_t ms)
+{
+    struct itimerspec ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.it_value.tv_sec = ms / 1000;
+    ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+    timerfd_settime(timer, 0, &ts, NULL);
+}
+
+int loop_signal(int signum, loop_signal_cb cb)
+{
+    if (signals_num == MAX_SIGNALS) {
+        fprintf(stderr, "Too many signal handlers\n");
+        return EIO;
+    }
+
+    sigaddset(&signal_mask, signum);
+    if (sigprocmask(SIG_BLOCK, &signal_mask, NULL) == -1 ||
+        (signal_fd = signalfd(signal_fd, &signal_mask,
+                              SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to setup signal handler: [%i] %s\n", ec,
+                strerror(ec));
+        return ec;
+    }
+    if (!find_handler(signal_fd)) {
+        const int rc = loop_add(signal_fd, EPOLLIN, on_signal, NULL);
+        if (rc) {
+            return rc;
+        }
+    }
+
+    signals[signals_num].signum = signum;
+    signals[signals_num].cb = cb;
+    ++signals_num;
+
+    return 0;
+}
+
+int loop_run(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    running = true;
+    stop_rc = 0;
+
+    while (running) {
+        const int num = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (num == -1) {
+            const int ec = errno;
+            if (ec == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Main loop error: [%i] %s\n", ec, strerror(ec));
+            return ec;
+        }
+        for (int i = 0; i < num && running; ++i) {
+            const struct handler* hdl = events[i].data.ptr;
+            int rc;
+            if (hdl->fd == -1) {
+                continue; // removed by the previous handler
+            }
+            if (hdl->timer_cb) {
+                uint64_t expirations;
+                if (read(hdl->fd, &expirations, sizeof(expirations)) !=
+                    sizeof(expirations)) {
+                    continue; // timer was reset
+                }
+                rc = hdl->timer_cb(hdl->data);
+            } else {
+                rc = hdl->fd_cb(hdl->fd, events[i].events, hdl->data);
+            }
+            if (rc) {
+                return rc;
+            }
+        }
+    }
+
+    return stop_rc;
+}
+
+void loop_stop(int rc)
+{
+    running = false;
+    stop_rc = rc;
+}
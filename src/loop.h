@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Callback function: File descriptor is ready.
+ * @param[in] fd file descriptor
+ * @param[in] events epoll events (EPOLLIN, EPOLLOUT, etc)
+ * @param[in] data user data passed to loop_add
+ * @return error code, non-zero value stops the loop
+ */
+typedef int (*loop_fd_cb)(int fd, uint32_t events, void* data);
+
+/**
+ * Callback function: Timer expired.
+ * @param[in] data user data passed to loop_timer
+ * @return error code, non-zero value stops the loop
+ */
+typedef int (*loop_timer_cb)(void* data);
+
+/**
+ * Callback function: Signal received.
+ * @param[in] signum signal number
+ * @return error code, non-zero value stops the loop
+ */
+typedef int (*loop_signal_cb)(int signum);
+
+/**
+ * Initialize the main loop.
+ * @return error code, 0 on success
+ */
+int loop_init(void);
+
+/**
+ * Add file descriptor to the main loop.
+ * @param[in] fd file descriptor
+ * @param[in] events epoll events to watch
+ * @param[in] cb callback function
+ * @param[in] data user data to pass to the callback
+ * @return error code, 0 on success
+ */
+int loop_add(int fd, uint32_t events, loop_fd_cb cb, void* data);
+
+/**
+ * Change watched events for the file descriptor.
+ * @param[in] fd file descriptor
+ * @param[in] events epoll events to watch
+ * @return error code, 0 on success
+ */
+int loop_modify(int fd, uint32_t events);
+
+/**
+ * Remove file descriptor from the main loop.
+ * @param[in] fd file descriptor
+ */
+void loop_remove(int fd);
+
+/**
+ * Create timer.
+ * @param[in] cb callback function
+ * @param[in] data user data to pass to the callback
+ * @return timer id (non-negative number) on successful completion,
+ *         otherwise error code (negative number)
+ */
+int loop_timer(loop_timer_cb cb, void* data);
+
+/**
+ * Start or stop the one-shot timer.
+ * @param[in] timer timer id
+ * @param[in] ms timeout in milliseconds, 0 to stop the timer
+ */
+void loop_timer_set(int timer, size_t ms);
+
+/**
+ * Set signal handler, the signal is delivered synchronously by the loop.
+ * @param[in] signum signal number
+ * @param[in] cb callback function
+ * @return error code, 0 on success
+ */
+int loop_signal(int signum, loop_signal_cb cb);
+
+/**
+ * Run the main loop.
+ * @return error code that stopped the loop
+ */
+int loop_run(void);
+
+/**
+ * Stop the main loop.
+ * @param[in] rc code to return from loop_run
+ */
+void loop_stop(int rc);
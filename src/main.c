@@ -1,133 +1,648 @@
 // SPDX-License-Identifier: MIT
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
+#include "buffer.h"
+#include "config.h"
+#include "control.h"
+#include "hash.h"
 #include "layouts.h"
+#include "loop.h"
+#include "matcher.h"
+#include "metrics.h"
+#include "record.h"
+#include "rules.h"
 #include "sway.h"
+#include "trace.h"
 
 #include <stdbool.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <unistd.h>
 
-// Default layout for new windows
-#define DEFAULT_LAYOUT  0
-// Default ignored time between layout change and focus lost events
-#define DEFAULT_TIMEOUT 50
-// Default list of tab-enabled app IDs
-#define DEFAULT_TABAPPS "firefox,chrome"
+// Number of window/tab states preallocated at startup
+#define STATES_CAPACITY 1024
+// Interval of writing metrics file, milliseconds
+#define METRICS_INTERVAL 10000
+// Name of the config file in the user's config directory
+#define CONFIG_FILE "swaykbdd/config"
+// Max number of settings given on the command line
+#define OPTIONS_MAX 16
 
-// Convert timespec to milliseconds
-#define TIMESPEC_MS(ts) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000)
+// Layouts are stored per window/tab, per workspace or per output
+enum scope { SCOPE_WINDOW, SCOPE_WORKSPACE, SCOPE_OUTPUT };
+static enum scope scope = SCOPE_WINDOW;
+// Bit set in the keys of workspaces and outputs to separate them from
+// container ids
+#define SCOPE_KEY_BIT 0x80000000
 
-// Identifiers of the last focused window and its tab
+// Identifiers of the last focused window (workspace/output key) and its tab
 static uint32_t last_wnd;
-static uint32_t last_tab;
-// Default layout for new windows
-static int default_layout = DEFAULT_LAYOUT;
+static uint64_t last_tab;
 // Currently active layout
 static int current_layout = INVALID_LAYOUT;
-// Ignored time between layout change and focus lost
-static size_t switch_timeout = DEFAULT_TIMEOUT;
-static struct timespec switch_timestamp;
-// List of tab-enbled applications
-static char** tab_apps_list;
-static size_t tab_apps_num;
-// Verbose (event trace) mode
-static bool verbose = false;
-#define TRACE(fmt, ...) if (verbose) printf("%s: " fmt "\n", __func__, ##__VA_ARGS__)
+// Active settings, replaced as a whole on reload, so handlers see either
+// the old or the new ones
+static struct config* config;
+// Path to the config file
+static const char* config_path;
+// Settings from the command line, applied on top of the config file
+static struct config_option options[OPTIONS_MAX];
+static size_t options_num;
+// Number of config reloads
+static size_t reloads;
+// Path to the file to keep layouts between restarts
+static const char* state_file;
+// Path to the metrics file and its update timer
+static const char* metrics_file;
+static int metrics_timer = -1;
+// Title changes of the focused window are handled after the quiet period,
+// intermediate titles are absorbed
+static int title_timer = -1;
+static bool title_pending;
+static int title_wnd;
+static const char* title_app;
+static const char* title_text;
+static struct buffer title_buf;
+static size_t titles_absorbed;
+// Path to the control socket
+static const char* control_path;
+// Window and layout sent to control clients last time
+static uint32_t notified_wnd;
+static int notified_layout = INVALID_LAYOUT;
+// Name of the trace dump file
+#define TRACE_FILE "swaykbdd.trace"
+// Total number of heap allocations made by the storage and buffers
+static size_t heap_allocs;
+
+/** Trace heap allocations made since the last check. */
+static void trace_allocs(void)
+{
+    struct layouts_stats stats;
+    get_layouts_stats(&stats);
+    const size_t total = stats.allocs + buf_allocs();
+    if (total != heap_allocs) {
+        heap_allocs = total;
+        trace_put(TRACE_ALLOCS, 0, heap_allocs, 0);
+    }
+}
+
+/**
+ * Check if the application has its own layout for each tab.
+ * @param[in] app_id application id, can be NULL
+ * @return true if application is in the list of tab-enabled apps
+ */
+static bool is_tab_app(const char* app_id)
+{
+    return matcher_find(&config->tab_apps, app_id) != MATCHER_NONE;
+}
+
+/**
+ * Notify control clients about focus or layout change.
+ */
+static void notify_state(void)
+{
+    if (notified_wnd != last_wnd) {
+        notified_wnd = last_wnd;
+        notified_layout = current_layout;
+        control_notify("focus %u %d", last_wnd, current_layout);
+    } else if (notified_layout != current_layout) {
+        notified_layout = current_layout;
+        control_notify("layout %d", current_layout);
+    }
+}
+
+/**
+ * Get layout defined by rules for the window.
+ * Rules are evaluated once per window, the result is cached in the storage.
+ * @param[in] wnd_id window id
+ * @param[in] app_id application id, can be NULL
+ * @param[in] title window title, can be NULL
+ * @return layout index, INVALID_LAYOUT if no rule matched
+ */
+static int rule_layout(int wnd_id, const char* app_id, const char* title)
+{
+    int layout = get_window_rule(wnd_id);
+    if (layout == RULE_UNKNOWN) {
+        layout = rules_find(&config->rules, app_id, title);
+        put_window_rule(wnd_id, layout);
+        trace_put(TRACE_RULE, wnd_id, 0, layout);
+    }
+    return layout;
+}
+
+/**
+ * Drop postponed title change.
+ */
+static void drop_title(void)
+{
+    if (title_pending) {
+        title_pending = false;
+        ++titles_absorbed;
+    }
+}
+
+/**
+ * Save title change to handle it after the quiet period.
+ * @param[in] wnd_id window id
+ * @param[in] app_id application id, can be NULL
+ * @param[in] title window title, can be NULL
+ * @return false if not enough memory
+ */
+static bool save_title(int wnd_id, const char* app_id, const char* title)
+{
+    const size_t app_len = app_id ? strlen(app_id) + 1 : 0;
+    const size_t title_len = title ? strlen(title) + 1 : 0;
+
+    if (!buf_reserve(&title_buf, app_len + title_len)) {
+        return false;
+    }
+
+    title_app = app_id ? memcpy(title_buf.data, app_id, app_len) : NULL;
+    title_text = title ? memcpy(title_buf.data + app_len, title, title_len) :
+                         NULL;
+    title_wnd = wnd_id;
+
+    return true;
+}
+
+/**
+ * Save current layout for previously focused window.
+ */
+static void store_layout(void)
+{
+    if (last_wnd && current_layout != INVALID_LAYOUT) {
+        trace_put(TRACE_STORE, last_wnd, last_tab, current_layout);
+        put_layout(last_wnd, last_tab, current_layout);
+    }
+}
+
+/**
+ * Make the state focused.
+ * @param[in] wnd_id window id (workspace/output key)
+ * @param[in] tab_id tab id
+ * @param[in] layout layout of the state, INVALID_LAYOUT to use the default
+ * @return layout to set, INVALID_LAYOUT if it is already set
+ */
+static int focus_state(uint32_t wnd_id, uint64_t tab_id, int layout)
+{
+    if (layout == INVALID_LAYOUT && config->default_layout != INVALID_LAYOUT) {
+        layout = config->default_layout; // set default
+    }
+    if (layout == current_layout || !sway_layout_available(layout)) {
+        layout = INVALID_LAYOUT; // already set or no keyboard has it
+    }
+
+    last_wnd = wnd_id;
+    last_tab = tab_id;
+
+    if (layout != INVALID_LAYOUT) {
+        // consider the requested layout as current: the switch command can be
+        // postponed until the end of the focus burst, but layouts of windows
+        // passed through must be stored correctly
+        current_layout = layout;
+    }
+
+    notify_state();
+
+    trace_put(TRACE_SET, wnd_id, tab_id, layout);
+    return layout;
+}
 
 /** Focus change handler. */
 static int on_focus_change(int wnd_id, const char* app_id, const char* title)
 {
+    const uint64_t title_hash = str_hash(title);
     int layout;
-    uint32_t tab_id = 0;
+    uint64_t tab_id = 0;
+
+    trace_allocs();
+    drop_title();
 
     // generate unique tab id from window title (if it is a browser)
-    if (app_id && title) {
-        for (size_t i = 0; i < tab_apps_num; ++i) {
-            if (strcmp(app_id, tab_apps_list[i]) == 0) {
-                const char* ptr = title;
-                // djb2 hash
-                tab_id = 5381;
-                while (*ptr) {
-                    tab_id = ((tab_id << 5) + tab_id) + *ptr++;
-                }
-                break;
-            }
-        }
+    if (is_tab_app(app_id)) {
+        tab_id = title_hash;
     }
+    trace_put(TRACE_FOCUS, wnd_id, tab_id, 0);
 
-    // save current layout for previously focused window
-    if (last_wnd && current_layout != INVALID_LAYOUT) {
-        if (switch_timeout == 0) {
-            layout = current_layout;
-        } else {
-            // check for timeout
-            size_t elapsed;
-            struct timespec ts;
-            clock_gettime(CLOCK_MONOTONIC, &ts);
-            elapsed = TIMESPEC_MS(ts) - TIMESPEC_MS(switch_timestamp);
-            if (elapsed > switch_timeout) {
-                layout = current_layout;
-            } else {
-                layout = INVALID_LAYOUT;
-            }
-        }
-        if (layout != INVALID_LAYOUT) {
-            TRACE("store layout=%d, window=%x:%x", layout, last_wnd, last_tab);
-            put_layout(last_wnd, last_tab, layout);
-        }
-    }
+    store_layout();
 
     // define layout for currently focused window
     layout = get_layout(wnd_id, tab_id);
-    TRACE("found layout=%d, window=%x:%x", layout, wnd_id, tab_id);
-    if (layout == INVALID_LAYOUT && default_layout != INVALID_LAYOUT) {
-        layout = default_layout; // set default
+    trace_put(TRACE_FOUND, wnd_id, tab_id, layout);
+    if (layout == INVALID_LAYOUT) {
+        layout = rule_layout(wnd_id, app_id, title);
     }
-    if (layout == current_layout) {
-        layout = INVALID_LAYOUT; // already set
+
+    put_window_info(wnd_id, str_hash(app_id), title_hash);
+
+    return focus_state(wnd_id, tab_id, layout);
+}
+
+/**
+ * Get storage key of the workspace or output, depending on the scope.
+ * Keys are derived from names, so they are stable across restarts of the
+ * compositor.
+ * @param[in] workspace name of the workspace, can be NULL
+ * @param[in] output name of the output, can be NULL
+ * @return key, 0 if the name is unknown
+ */
+static uint32_t scope_key(const char* workspace, const char* output)
+{
+    const char* name = scope == SCOPE_OUTPUT ? output : workspace;
+    return name ? (uint32_t)str_hash(name) | SCOPE_KEY_BIT : 0;
+}
+
+/** Workspace focus change handler. */
+static int on_workspace_focus(const char* workspace, const char* output)
+{
+    const uint32_t key = scope_key(workspace, output);
+    int layout;
+
+    if (!key || key == last_wnd) {
+        return INVALID_LAYOUT;
     }
 
-    last_wnd = wnd_id;
-    last_tab = tab_id;
+    trace_allocs();
+    trace_put(TRACE_FOCUS, key, 0, 0);
 
-    TRACE("set layout=%d, window=%x:%x", layout, wnd_id, tab_id);
-    return layout;
+    store_layout();
+
+    layout = get_layout(key, 0);
+    trace_put(TRACE_FOUND, key, 0, layout);
+
+    return focus_state(key, 0, layout);
 }
 
 /** Title change handler. */
 static int on_title_change(int wnd_id, const char* app_id, const char* title)
 {
-    if (last_wnd == (uint32_t)wnd_id) {
-        TRACE("window_id=%d", wnd_id);
-        return on_focus_change(wnd_id, app_id, title);
+    if (last_wnd != (uint32_t)wnd_id) {
+        return INVALID_LAYOUT;
+    }
+    trace_put(TRACE_TITLE, wnd_id, 0, 0);
+
+    if (config->debounce && save_title(wnd_id, app_id, title)) {
+        if (title_pending) {
+            ++titles_absorbed; // replaced by the new one
+        }
+        title_pending = true;
+        loop_timer_set(title_timer, config->debounce);
+        return INVALID_LAYOUT;
     }
-    return INVALID_LAYOUT;
+
+    return on_focus_change(wnd_id, app_id, title);
+}
+
+/** Title quiet period timer handler, see loop_timer_cb for details. */
+static int on_title_timeout(void* data)
+{
+    (void)data;
+
+    if (title_pending) {
+        title_pending = false;
+        const int layout = on_focus_change(title_wnd, title_app, title_text);
+        if (layout != INVALID_LAYOUT) {
+            sway_switch_layout(layout);
+        }
+    }
+
+    return 0;
 }
 
 /** Window close handler. */
 static int on_window_close(int wnd_id)
 {
-    TRACE("window=%x:*", wnd_id);
+    int layout;
+
+    trace_allocs();
+    trace_put(TRACE_CLOSE, wnd_id, 0, 0);
     rm_layout(wnd_id);
 
     if (last_wnd == (uint32_t)wnd_id) {
         // reset last window id to prevent saving layout for the closed window
         last_wnd = 0;
+        drop_title();
     }
 
-    return default_layout;
+    layout = config->default_layout;
+    if (sway_layout_available(layout)) {
+        current_layout = layout;
+    } else {
+        layout = INVALID_LAYOUT; // no keyboard has it, nothing to switch
+    }
+
+    notify_state();
+
+    return layout;
+}
+
+/** State synchronization handler. */
+static void on_sync_state(const struct sway_window* windows, size_t num,
+                          const char* workspace, const char* output,
+                          int layout)
+{
+    struct window_info* list;
+
+    drop_title();
+    last_wnd = 0;
+    last_tab = 0;
+
+    if (scope != SCOPE_WINDOW) {
+        // keys are stable, nothing to restore
+        last_wnd = scope_key(workspace, output);
+        current_layout = layout;
+        notify_state();
+        trace_put(TRACE_SYNC, last_wnd, last_tab, layout);
+        return;
+    }
+
+    list = malloc((num ? num : 1) * sizeof(*list));
+    if (!list) {
+        fprintf(stderr, "Not enough memory\n");
+        return;
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        const struct sway_window* wnd = &windows[i];
+        list[i].id = wnd->id;
+        list[i].app = str_hash(wnd->app_id);
+        list[i].title = str_hash(wnd->title);
+        if (wnd->focused) {
+            last_wnd = wnd->id;
+            last_tab = is_tab_app(wnd->app_id) ? list[i].title : 0;
+        }
+    }
+
+    // drop layouts of windows closed while we were not connected, restore
+    // the rest (ids are changed if the compositor was restarted)
+    restore_layouts(list, num);
+    free(list);
+
+    current_layout = layout;
+
+    notify_state();
+
+    trace_put(TRACE_SYNC, last_wnd, last_tab, layout);
 }
 
 /** Keyboard layout change handler. */
 static void on_layout_change(int layout)
 {
-    TRACE("layout=%d, window=%x:%x", layout, last_wnd, last_tab);
+    trace_allocs();
+    trace_put(TRACE_LAYOUT, last_wnd, last_tab, layout);
     current_layout = layout;
-    clock_gettime(CLOCK_MONOTONIC, &switch_timestamp);
+    notify_state();
+}
+
+/** Stored state visitor: send state to the control client. */
+static void dump_state(uint32_t window, uint64_t tab, int layout, void* data)
+{
+    control_reply(*(int*)data, "%u %" PRIx64 " %d", window, tab, layout);
+}
+
+/** Control request handler, see control_request_cb for details. */
+static void on_control_request(int client, char* request)
+{
+    char cmd[16];
+    unsigned int window;
+    int layout;
+    char tail;
+
+    const int num = sscanf(request, "%15s %u %d %c", cmd, &window, &layout,
+                           &tail);
+    if (num <= 0) {
+        return; // empty line
+    }
+
+    if (strcmp(cmd, "subscribe") == 0 && num == 1) {
+        control_subscribe(client);
+        control_reply(client, "focus %u %d", last_wnd, current_layout);
+    } else if (strcmp(cmd, "get") == 0 && num <= 2) {
+        if (num == 1) {
+            window = last_wnd;
+        }
+        // layout of the focused window is stored only when it loses focus
+        layout = window == last_wnd ? current_layout :
+                                      peek_layout(window, NULL);
+        control_reply(client, "ok %d", layout);
+    } else if (strcmp(cmd, "set") == 0 && num == 3 && layout >= 0) {
+        if (!sway_layout_available(layout)) {
+            control_reply(client, "error no keyboard has layout %d", layout);
+            return;
+        }
+        if (window == last_wnd) {
+            const int rc = sway_switch_layout(layout);
+            if (rc) {
+                control_reply(client, "error %s", strerror(rc));
+                return;
+            }
+            current_layout = layout;
+            notify_state();
+        } else {
+            uint64_t tab = 0;
+            peek_layout(window, &tab);
+            put_layout(window, tab, layout);
+        }
+        control_reply(client, "ok");
+    } else if (strcmp(cmd, "dump") == 0 && num == 1) {
+        struct layouts_stats stats;
+        get_layouts_stats(&stats);
+        walk_layouts(dump_state, &client);
+        control_reply(client, "ok %zu", stats.entries);
+    } else {
+        control_reply(client, "error invalid request");
+    }
+}
+
+/**
+ * Reload settings from the config file and the command line.
+ * The new settings are compiled completely before replacing the active ones,
+ * stored layouts are kept.
+ * @return false if the new settings are invalid, the active ones are kept
+ */
+static bool reload_config(void)
+{
+    struct config* cfg = config_load(config_path, options, options_num);
+    if (!cfg) {
+        fprintf(stderr, "Config is not reloaded, previous settings are kept\n");
+        return false;
+    }
+
+    config_free(config);
+    config = cfg;
+    set_layouts_limits(config->max_tabs, config->max_states);
+    reset_window_rules(); // cached results of the previous rules
+
+    trace_put(TRACE_CONFIG, 0, ++reloads, 0);
+    return true;
+}
+
+/** Config file change handler, see config_changed_cb for details. */
+static void on_config_change(void)
+{
+    reload_config();
+}
+
+/** Reload signal handler, see loop_signal_cb for details. */
+static int on_reload(int signum)
+{
+    trace_put(TRACE_SIGNAL, 0, signum, 0);
+    reload_config();
+    return 0;
+}
+
+/**
+ * Add setting from the command line.
+ * @param[in] key name of the setting
+ * @param[in] value value of the setting
+ * @return false if there are too many settings
+ */
+static bool add_option(const char* key, const char* value)
+{
+    if (options_num >= OPTIONS_MAX) {
+        fprintf(stderr, "Too many options\n");
+        return false;
+    }
+    options[options_num].key = key;
+    options[options_num].value = value;
+    ++options_num;
+    return true;
+}
+
+/** Termination signals handler, see loop_signal_cb for details. */
+static int on_terminate(int signum)
+{
+    trace_put(TRACE_SIGNAL, 0, signum, 0);
+    loop_stop(EXIT_SUCCESS);
+    return 0;
+}
+
+/** Trace dump signal handler, see loop_signal_cb for details. */
+static int on_dump_trace(int signum)
+{
+    trace_put(TRACE_SIGNAL, 0, signum, 0);
+    if (!trace_dump()) {
+        fprintf(stderr, "Unable to write trace file\n");
+    }
+    return 0;
+}
+
+/** Statistics dump signal handler, see loop_signal_cb for details. */
+static int on_dump_stats(int signum)
+{
+    struct layouts_stats stats;
+    struct sway_stats ipc;
+
+    (void)signum;
+
+    get_layouts_stats(&stats);
+    sway_stats(&ipc);
+
+    printf("windows: %zu\n", stats.windows);
+    printf("states: %zu\n", stats.entries);
+    printf("capacity: %zu\n", stats.capacity);
+    printf("evictions: %zu\n", stats.evictions);
+    printf("lookups: hits=%zu, misses=%zu\n", stats.hits, stats.misses);
+    printf("memory: %zu bytes\n", stats.bytes);
+    printf("allocations: %zu\n", stats.allocs + buf_allocs());
+    printf("commands: %zu\n", ipc.commands);
+    printf("failures: %zu\n", ipc.failures);
+    printf("reconnects: %zu\n", ipc.reconnects);
+    printf("divergences: %zu\n", ipc.divergences);
+    printf("own layout changes: %zu\n", ipc.own_events);
+    printf("collapsed commands: %zu\n", ipc.collapsed);
+    printf("absorbed titles: %zu\n", titles_absorbed);
+    printf("config reloads: %zu\n", reloads);
+    printf("latency: last=%llu, max=%llu, avg=%llu us\n",
+           (unsigned long long)ipc.latency_last,
+           (unsigned long long)ipc.latency_max,
+           (unsigned long long)(ipc.commands ?
+                                ipc.latency_total / ipc.commands : 0));
+    metrics_write(stdout);
+    fflush(stdout);
+
+    return 0;
+}
+
+/**
+ * Write gauge metric in Prometheus text format.
+ * @param[in] fp output stream
+ * @param[in] name metric name
+ * @param[in] help metric description
+ * @param[in] value metric value
+ */
+static void write_gauge(FILE* fp, const char* name, const char* help,
+                        unsigned long long value)
+{
+    fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name,
+            name, value);
+}
+
+/** Metrics timer handler: write metrics file, see loop_timer_cb for details. */
+static int on_metrics_timer(void* data)
+{
+    struct layouts_stats stats;
+    struct sway_stats ipc;
+    char tmp[4096];
+
+    (void)data;
+
+    loop_timer_set(metrics_timer, METRICS_INTERVAL);
+
+    // write to the temporary file to replace the metrics file atomically
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_file) >=
+        sizeof(tmp)) {
+        return 0;
+    }
+    FILE* fp = fopen(tmp, "w");
+    if (!fp) {
+        return 0;
+    }
+
+    get_layouts_stats(&stats);
+    sway_stats(&ipc);
+    write_gauge(fp, "swaykbdd_windows", "Windows with stored layouts",
+                stats.windows);
+    write_gauge(fp, "swaykbdd_states", "Stored window/tab layouts",
+                stats.entries);
+    write_gauge(fp, "swaykbdd_states_capacity", "Preallocated states",
+                stats.capacity);
+    write_gauge(fp, "swaykbdd_store_bytes", "Memory used by the storage",
+                stats.bytes);
+    write_gauge(fp, "swaykbdd_evictions", "States evicted due to limits",
+                stats.evictions);
+    write_gauge(fp, "swaykbdd_lookup_hits", "Lookups with stored layout",
+                stats.hits);
+    write_gauge(fp, "swaykbdd_lookup_misses", "Lookups without stored layout",
+                stats.misses);
+    write_gauge(fp, "swaykbdd_commands", "Layout switch commands sent",
+                ipc.commands);
+    write_gauge(fp, "swaykbdd_command_failures", "Failed switch commands",
+                ipc.failures);
+    write_gauge(fp, "swaykbdd_commands_collapsed",
+                "Commands replaced before sending", ipc.collapsed);
+    write_gauge(fp, "swaykbdd_command_latency_max_us",
+                "Max switch command latency", ipc.latency_max);
+    write_gauge(fp, "swaykbdd_reconnects", "Restored IPC connections",
+                ipc.reconnects);
+    write_gauge(fp, "swaykbdd_titles_absorbed",
+                "Title changes dropped by the quiet period", titles_absorbed);
+    write_gauge(fp, "swaykbdd_layout_divergences",
+                "Keyboards got different active layouts", ipc.divergences);
+    write_gauge(fp, "swaykbdd_config_reloads", "Config reloads", reloads);
+    metrics_write(fp);
+
+    if (fclose(fp) == 0) {
+        rename(tmp, metrics_file);
+    } else {
+        remove(tmp);
+    }
+
+    return 0;
 }
 
 /**
@@ -139,13 +654,31 @@ int main(int argc, char* argv[])
         { "default", required_argument, NULL, 'd' },
         { "timeout", required_argument, NULL, 't' },
         { "tabapps", required_argument, NULL, 'a' },
+        { "state",   required_argument, NULL, 's' },
+        { "maxtabs", required_argument, NULL, 'm' },
+        { "maxstates", required_argument, NULL, 'M' },
+        { "metrics", required_argument, NULL, 'p' },
+        { "record",  required_argument, NULL, 'r' },
+        { "replay",  required_argument, NULL, 'R' },
+        { "control", required_argument, NULL, 'c' },
+        { "rules",   required_argument, NULL, 'f' },
+        { "trace",   required_argument, NULL, 'T' },
+        { "decode",  required_argument, NULL, 'D' },
+        { "debounce", required_argument, NULL, 'b' },
+        { "config",  required_argument, NULL, 'C' },
+        { "scope",   required_argument, NULL, 'S' },
         { "verbose", no_argument,       NULL, 'V' },
         { "version", no_argument,       NULL, 'v' },
         { "help",    no_argument,       NULL, 'h' },
         { NULL,      0,                 NULL,  0  }
     };
-    const char* short_opts = "d:t:a:Vvh";
-    const char* tab_apps = DEFAULT_TABAPPS;
+    const char* short_opts = "d:t:a:s:m:M:p:r:R:c:f:T:D:b:C:S:Vvh";
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    const char* trace_path = NULL;
+    char trace_default[4096];
+    char config_default[4096];
+    int rc;
 
     opterr = 0; // prevent native error messages
 
@@ -154,20 +687,75 @@ int main(int argc, char* argv[])
     while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
         switch (opt) {
             case 'd':
-                default_layout = atoi(optarg);
-                if (default_layout < 0 || default_layout > 0xffff) {
-                    fprintf(stderr, "Invalid default layout: %s\n", optarg);
+                if (!add_option("default", optarg)) {
                     return EXIT_FAILURE;
                 }
                 break;
             case 't':
-                switch_timeout = atoi(optarg);
+                fprintf(stderr, "Option --timeout is deprecated and ignored\n");
                 break;
             case 'a':
-                tab_apps = optarg;
+                if (!add_option("tabapps", optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                state_file = optarg;
+                break;
+            case 'p':
+                metrics_file = optarg;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            case 'c':
+                control_path = optarg;
+                break;
+            case 'f':
+                if (!add_option("rules", optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'b':
+                if (!add_option("debounce", optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'C':
+                config_path = optarg;
+                break;
+            case 'S':
+                if (strcmp(optarg, "window") == 0) {
+                    scope = SCOPE_WINDOW;
+                } else if (strcmp(optarg, "workspace") == 0) {
+                    scope = SCOPE_WORKSPACE;
+                } else if (strcmp(optarg, "output") == 0) {
+                    scope = SCOPE_OUTPUT;
+                } else {
+                    fprintf(stderr, "Invalid scope: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'D':
+                return trace_decode(optarg) ? EXIT_FAILURE : EXIT_SUCCESS;
+            case 'm':
+                if (!add_option("maxtabs", optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'M':
+                if (!add_option("maxstates", optarg)) {
+                    return EXIT_FAILURE;
+                }
                 break;
             case 'V':
-                verbose = true;
+                trace_echo(true);
                 break;
             case 'v':
                 printf("swaykbdd version " VERSION ".\n");
@@ -177,10 +765,32 @@ int main(int argc, char* argv[])
                 printf("Usage: %s [OPTION]\n", argv[0]);
                 printf("  -d, --default=ID  Default layout for new windows "
                        "[%i]\n", DEFAULT_LAYOUT);
-                printf("  -t, --timeout=MS  Delay between switching and "
-                       "saving layout [%i ms]\n", DEFAULT_TIMEOUT);
                 printf("  -a, --tabapps=IDS List of tab-enabled app IDs "
                        "[" DEFAULT_TABAPPS "]\n");
+                printf("  -s, --state=FILE  File to keep layouts between "
+                       "restarts\n");
+                printf("  -m, --maxtabs=NUM Max number of stored tabs per "
+                       "window, 0 for no limit [%i]\n", DEFAULT_MAXTABS);
+                printf("  -M, --maxstates=NUM Max number of stored states, "
+                       "0 for no limit [%i]\n", DEFAULT_MAXSTATES);
+                printf("  -p, --metrics=FILE Write metrics to the file "
+                       "(Prometheus format)\n");
+                printf("  -r, --record=FILE Record IPC messages to the file\n");
+                printf("  -R, --replay=FILE Replay recorded IPC messages "
+                       "and exit\n");
+                printf("  -c, --control=FILE Serve control requests on the "
+                       "unix socket\n");
+                printf("  -S, --scope=SCOPE Store layouts per window, "
+                       "workspace or output [window]\n");
+                printf("  -f, --rules=FILE  Load rules of initial layouts "
+                       "from the file\n");
+                printf("  -b, --debounce=MS Quiet period for title changes, "
+                       "0 to disable [%i ms]\n", DEFAULT_DEBOUNCE);
+                printf("  -C, --config=FILE Config file, reloaded on changes "
+                       "[$XDG_CONFIG_HOME/" CONFIG_FILE "]\n");
+                printf("  -T, --trace=FILE  Trace dump file "
+                       "[$XDG_RUNTIME_DIR/" TRACE_FILE "]\n");
+                printf("  -D, --decode=FILE Print trace dump and exit\n");
                 printf("  -V, --verbose     Enable verbose output (event trace)\n");
                 printf("  -v, --version     Print version info and exit\n");
                 printf("  -h, --help        Print this help and exit\n");
@@ -195,32 +805,121 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
-    if (*tab_apps) {
-        size_t i = 0;
-        // create list of tab-enabled app IDs
-        tab_apps_num = 1;
-        for (const char* ptr = tab_apps; *ptr; ++ptr) {
-            if (*ptr == ',') {
-                ++tab_apps_num;
-            }
+    if (!trace_path) {
+        // no default in shared directories like /tmp: the file is written
+        // on crash and could be replaced with a link by another user
+        const char* dir = getenv("XDG_RUNTIME_DIR");
+        if (dir && *dir) {
+            snprintf(trace_default, sizeof(trace_default), "%s/" TRACE_FILE,
+                     dir);
+            trace_path = trace_default;
         }
-        tab_apps_list = malloc(tab_apps_num * sizeof(char*));
-        // split into array
-        for (const char* ptr = tab_apps;; ++ptr) {
-            if (!*ptr || *ptr == ',') {
-                const size_t len = ptr - tab_apps;
-                char* app_id = malloc(len + 1 /* last null */);
-                memcpy(app_id, tab_apps, len);
-                app_id[len] = 0;
-                tab_apps_list[i++] = app_id;
-                tab_apps = ptr + 1;
-                if (!*ptr) {
-                    break;
-                }
-            }
+    }
+    if (!trace_init(trace_path)) {
+        return EXIT_FAILURE;
+    }
+
+    if (replay_path && !add_option("debounce", "0")) {
+        return EXIT_FAILURE; // timers are not available in replay mode
+    }
+    if (!config_path) {
+        // the default config file is optional
+        const char* dir = getenv("XDG_CONFIG_HOME");
+        const char* home = getenv("HOME");
+        if (dir) {
+            snprintf(config_default, sizeof(config_default), "%s/" CONFIG_FILE,
+                     dir);
+        } else {
+            snprintf(config_default, sizeof(config_default),
+                     "%s/.config/" CONFIG_FILE, home ? home : "");
+        }
+        if (access(config_default, F_OK) == 0) {
+            config_path = config_default;
+        }
+    }
+    config = config_load(config_path, options, options_num);
+    if (!config) {
+        return EXIT_FAILURE;
+    }
+
+    if (!init_layouts(STATES_CAPACITY, state_file)) {
+        return EXIT_FAILURE;
+    }
+    set_layouts_limits(config->max_tabs, config->max_states);
+
+    if (replay_path) {
+        rc = scope == SCOPE_WINDOW ?
+            sway_replay(replay_path, on_focus_change, on_title_change,
+                        on_window_close, NULL, on_layout_change,
+                        on_sync_state) :
+            sway_replay(replay_path, NULL, NULL, NULL, on_workspace_focus,
+                        on_layout_change, on_sync_state);
+        if (rc == 0) {
+            on_dump_stats(0);
+        }
+        return rc;
+    }
+    if (record_path && !record_open(record_path)) {
+        return EXIT_FAILURE;
+    }
+
+    rc = loop_init();
+    if (rc == 0) {
+        // created even if disabled, can be enabled by reloading config
+        title_timer = loop_timer(on_title_timeout, NULL);
+        if (title_timer < 0) {
+            rc = -title_timer;
         }
     }
+    if (rc == 0) {
+        const int signals[] = { SIGTERM, SIGINT };
+        for (size_t i = 0; rc == 0 && i < sizeof(signals) / sizeof(signals[0]);
+             ++i) {
+            rc = loop_signal(signals[i], on_terminate);
+        }
+    }
+    if (rc == 0) {
+        rc = loop_signal(SIGUSR1, on_dump_stats);
+    }
+    if (rc == 0) {
+        rc = loop_signal(SIGUSR2, on_dump_trace);
+    }
+    if (rc == 0) {
+        rc = loop_signal(SIGHUP, on_reload);
+    }
+    if (rc == 0 && config_path) {
+        rc = config_watch(config_path, on_config_change);
+    }
+    if (rc == 0 && metrics_file) {
+        metrics_timer = loop_timer(on_metrics_timer, NULL);
+        if (metrics_timer < 0) {
+            rc = -metrics_timer;
+        } else {
+            loop_timer_set(metrics_timer, METRICS_INTERVAL);
+        }
+    }
+    if (rc == 0 && control_path) {
+        rc = control_init(control_path, on_control_request);
+    }
+    if (rc == 0) {
+        // window events are not subscribed in workspace and output scopes
+        rc = scope == SCOPE_WINDOW ?
+            sway_monitor(on_focus_change, on_title_change, on_window_close,
+                         NULL, on_layout_change, on_sync_state) :
+            sway_monitor(NULL, NULL, NULL, on_workspace_focus,
+                         on_layout_change, on_sync_state);
+    }
+    if (rc == 0) {
+        rc = loop_run();
+    }
+
+    control_close();
+    config_unwatch();
+    record_close();
+
+    if (rc) {
+        trace_dump(); // abnormal exit
+    }
 
-    return sway_monitor(on_focus_change, on_title_change,
-                        on_window_close, on_layout_change);
+    return rc;
 }
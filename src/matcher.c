@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "matcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Index of the root node, also used as "no node" for child/sibling links
+#define ROOT 0
+
+/** Prefix tree node: children are linked through the sibling list. */
+struct matcher_node {
+    uint32_t child;   ///< first child node
+    uint32_t sibling; ///< next node with the same parent
+    int exact;        ///< value of the exact pattern ending here
+    int prefix;       ///< value of the prefix pattern ending here
+    char ch;          ///< character of the edge from the parent
+};
+
+/**
+ * Allocate new node.
+ * @param[in] matcher matcher instance
+ * @param[in] ch character of the edge from the parent
+ * @return index of the new node, ROOT if not enough memory
+ */
+static uint32_t add_node(struct matcher* matcher, char ch)
+{
+    if (matcher->size == matcher->capacity) {
+        const uint32_t cap = matcher->capacity ? matcher->capacity * 2 : 32;
+        struct matcher_node* nodes =
+            realloc(matcher->nodes, cap * sizeof(struct matcher_node));
+        if (!nodes) {
+            fprintf(stderr, "Not enough memory\n");
+            return ROOT;
+        }
+        matcher->nodes = nodes;
+        matcher->capacity = cap;
+    }
+
+    struct matcher_node* node = &matcher->nodes[matcher->size];
+    node->child = ROOT;
+    node->sibling = ROOT;
+    node->exact = MATCHER_NONE;
+    node->prefix = MATCHER_NONE;
+    node->ch = ch;
+
+    return matcher->size++;
+}
+
+/**
+ * Get child node.
+ * @param[in] matcher matcher instance
+ * @param[in] parent index of the parent node
+ * @param[in] ch character of the edge
+ * @return index of the child node, ROOT if not found
+ */
+static uint32_t get_child(const struct matcher* matcher, uint32_t parent,
+                          char ch)
+{
+    uint32_t idx = matcher->nodes[parent].child;
+    while (idx != ROOT && matcher->nodes[idx].ch != ch) {
+        idx = matcher->nodes[idx].sibling;
+    }
+    return idx;
+}
+
+/**
+ * Add pattern to the matcher.
+ * @param[in] matcher matcher instance
+ * @param[in] pattern pattern string
+ * @param[in] len length of the pattern
+ * @param[in] value value associated with the pattern
+ * @return false if not enough memory
+ */
+static bool add_pattern(struct matcher* matcher, const char* pattern,
+                        size_t len, int value)
+{
+    const bool is_prefix = len && pattern[len - 1] == '*';
+    if (is_prefix) {
+        --len;
+    }
+
+    if (matcher->size == 0) {
+        add_node(matcher, 0); // root
+        if (matcher->size == 0) {
+            return false;
+        }
+    }
+
+    uint32_t idx = ROOT;
+    for (size_t i = 0; i < len; ++i) {
+        uint32_t child = get_child(matcher, idx, pattern[i]);
+        if (child == ROOT) {
+            child = add_node(matcher, pattern[i]);
+            if (child == ROOT) {
+                return false;
+            }
+            matcher->nodes[child].sibling = matcher->nodes[idx].child;
+            matcher->nodes[idx].child = child;
+        }
+        idx = child;
+    }
+
+    if (is_prefix) {
+        matcher->nodes[idx].prefix = value;
+    } else {
+        matcher->nodes[idx].exact = value;
+    }
+
+    return true;
+}
+
+bool matcher_add(struct matcher* matcher, const char* pattern, int value)
+{
+    return add_pattern(matcher, pattern, strlen(pattern), value);
+}
+
+bool matcher_add_list(struct matcher* matcher, const char* list, int value)
+{
+    while (*list) {
+        const size_t len = strcspn(list, ",");
+        if (len && !add_pattern(matcher, list, len, value)) {
+            return false;
+        }
+        list += len;
+        if (*list == ',') {
+            ++list;
+        }
+    }
+    return true;
+}
+
+int matcher_find(const struct matcher* matcher, const char* str)
+{
+    if (!str || matcher->size == 0) {
+        return MATCHER_NONE;
+    }
+
+    uint32_t idx = ROOT;
+    int value = matcher->nodes[ROOT].prefix;
+    while (*str) {
+        idx = get_child(matcher, idx, *str++);
+        if (idx == ROOT) {
+            return value;
+        }
+        if (matcher->nodes[idx].prefix != MATCHER_NONE) {
+            value = matcher->nodes[idx].prefix; // longest prefix wins
+        }
+    }
+
+    return matcher->nodes[idx].exact != MATCHER_NONE ?
+        matcher->nodes[idx].exact : value;
+}
+
+void matcher_free(struct matcher* matcher)
+{
+    free(matcher->nodes);
+    matcher->nodes = NULL;
+    matcher->size = 0;
+    matcher->capacity = 0;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MATCHER_NONE -1
+
+/**
+ * String matcher: set of patterns compiled into a single prefix tree.
+ * Pattern is an exact string or a prefix followed by '*' ("firefox*").
+ * Lookup time depends only on the length of the string, not on the number
+ * of patterns.
+ */
+struct matcher {
+    struct matcher_node* nodes;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+/**
+ * Add pattern to the matcher.
+ * @param[in] matcher matcher instance
+ * @param[in] pattern exact string or prefix followed by '*'
+ * @param[in] value value associated with the pattern (non-negative)
+ * @return false if not enough memory
+ */
+bool matcher_add(struct matcher* matcher, const char* pattern, int value);
+
+/**
+ * Add comma-separated list of patterns to the matcher.
+ * @param[in] matcher matcher instance
+ * @param[in] list comma-separated list of patterns
+ * @param[in] value value associated with all patterns (non-negative)
+ * @return false if not enough memory
+ */
+bool matcher_add_list(struct matcher* matcher, const char* list, int value);
+
+/**
+ * Find the best matching pattern: the exact one or the longest prefix.
+ * @param[in] matcher matcher instance
+ * @param[in] str string to check, can be NULL
+ * @return value of the matched pattern, MATCHER_NONE if not found
+ */
+int matcher_find(const struct matcher* matcher, const char* str);
+
+/**
+ * Free resources of the matcher.
+ * @param[in] matcher matcher instance
+ */
+void matcher_free(struct matcher* matcher);
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "metrics.h"
+
+#include <time.h>
+
+// Number of histogram buckets: upper bounds are 1, 2, 4 ... 2^19 us and +Inf
+#define BUCKETS_NUM 21
+
+/** Log-bucketed histogram of durations. */
+struct histogram {
+    uint64_t buckets[BUCKETS_NUM]; ///< non-cumulative counters
+    uint64_t count;
+    uint64_t sum; ///< sum of all values, nanoseconds
+};
+
+// Names of event types used as metric labels
+static const char* const type_names[EVENT_TYPES] = {
+    [EVENT_NONE] = "other",         [EVENT_FOCUS] = "focus",
+    [EVENT_TITLE] = "title",        [EVENT_CLOSE] = "close",
+    [EVENT_LAYOUT] = "xkb_layout",  [EVENT_KEYMAP] = "xkb_keymap",
+    [EVENT_ADDED] = "added",        [EVENT_REMOVED] = "removed",
+    [EVENT_WORKSPACE] = "workspace",
+};
+
+// Names of stages used as metric labels
+static const char* const stage_names[STAGES_NUM] = {
+    [STAGE_READ] = "read",     [STAGE_PARSE] = "parse",
+    [STAGE_HANDLE] = "handle", [STAGE_SWITCH] = "switch",
+};
+
+// Names of counters
+static const char* const counter_names[COUNTERS_NUM] = {
+    [COUNTER_PROCESSED] = "swaykbdd_events_processed_total",
+    [COUNTER_SKIPPED] = "swaykbdd_events_skipped_total",
+    [COUNTER_COALESCED] = "swaykbdd_events_coalesced_total",
+    [COUNTER_DUPLICATE] = "swaykbdd_events_duplicate_total",
+};
+
+static struct histogram histograms[EVENT_TYPES][STAGES_NUM];
+static uint64_t counters[EVENT_TYPES][COUNTERS_NUM];
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_stage(enum event_type type, enum metrics_stage stage,
+                   uint64_t start, uint64_t end)
+{
+    struct histogram* hist = &histograms[type][stage];
+    const uint64_t ns = end - start;
+    uint64_t us = (ns + 999) / 1000;
+    size_t bucket = 0;
+
+    // index of the first bucket with upper bound >= value
+    while (us > 1 && bucket < BUCKETS_NUM - 1) {
+        us = (us + 1) >> 1;
+        ++bucket;
+    }
+
+    ++hist->buckets[bucket];
+    ++hist->count;
+    hist->sum += ns;
+}
+
+void metrics_count(enum event_type type, enum metrics_counter counter)
+{
+    ++counters[type][counter];
+}
+
+void metrics_write(FILE* fp)
+{
+    fprintf(fp, "# HELP swaykbdd_event_stage_seconds "
+                "Duration of the event path stages\n"
+                "# TYPE swaykbdd_event_stage_seconds histogram\n");
+    for (size_t type = 0; type < EVENT_TYPES; ++type) {
+        for (size_t stage = 0; stage < STAGES_NUM; ++stage) {
+            const struct histogram* hist = &histograms[type][stage];
+            uint64_t total = 0;
+            if (!hist->count) {
+                continue;
+            }
+            for (size_t i = 0; i < BUCKETS_NUM; ++i) {
+                total += hist->buckets[i];
+                fprintf(fp, "swaykbdd_event_stage_seconds_bucket"
+                            "{type=\"%s\",stage=\"%s\",le=\"",
+                        type_names[type], stage_names[stage]);
+                if (i == BUCKETS_NUM - 1) {
+                    fprintf(fp, "+Inf");
+                } else {
+                    fprintf(fp, "%g", (double)(1 << i) / 1000000);
+                }
+                fprintf(fp, "\"} %llu\n", (unsigned long long)total);
+            }
+            fprintf(fp, "swaykbdd_event_stage_seconds_sum"
+                        "{type=\"%s\",stage=\"%s\"} %.9f\n",
+                    type_names[type], stage_names[stage],
+                    (double)hist->sum / 1000000000);
+            fprintf(fp, "swaykbdd_event_stage_seconds_count"
+                        "{type=\"%s\",stage=\"%s\"} %llu\n",
+                    type_names[type], stage_names[stage],
+                    (unsigned long long)hist->count);
+        }
+    }
+
+    for (size_t cnt = 0; cnt < COUNTERS_NUM; ++cnt) {
+        fprintf(fp, "# TYPE %s counter\n", counter_names[cnt]);
+        for (size_t type = 0; type < EVENT_TYPES; ++type) {
+            fprintf(fp, "%s{type=\"%s\"} %llu\n", counter_names[cnt],
+                    type_names[type],
+                    (unsigned long long)counters[type][cnt]);
+        }
+    }
+}
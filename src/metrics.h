@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "event.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Measured stages of the event path. */
+enum metrics_stage {
+    STAGE_READ,   ///< Reading message from the socket
+    STAGE_PARSE,  ///< Parsing the message
+    STAGE_HANDLE, ///< Handling the event (layout lookup)
+    STAGE_SWITCH, ///< From reading the event to writing the switch command
+    STAGES_NUM
+};
+
+/** Event counters. */
+enum metrics_counter {
+    COUNTER_PROCESSED, ///< Events handled
+    COUNTER_SKIPPED,   ///< Events skipped as irrelevant or invalid
+    COUNTER_COALESCED, ///< Layout requests replaced by the next event
+    COUNTER_DUPLICATE, ///< Events with already known state
+    COUNTERS_NUM
+};
+
+/**
+ * Get current monotonic time.
+ * @return timestamp in nanoseconds
+ */
+uint64_t metrics_now(void);
+
+/**
+ * Add stage duration to the histogram.
+ * @param[in] type event type
+ * @param[in] stage event path stage
+ * @param[in] start start timestamp of the stage, nanoseconds
+ * @param[in] end end timestamp of the stage, nanoseconds
+ */
+void metrics_stage(enum event_type type, enum metrics_stage stage,
+                   uint64_t start, uint64_t end);
+
+/**
+ * Increment event counter.
+ * @param[in] type event type
+ * @param[in] counter counter to increment
+ */
+void metrics_count(enum event_type type, enum metrics_counter counter);
+
+/**
+ * Write metrics in Prometheus text exposition format.
+ * @param[in] fp output stream
+ */
+void metrics_write(FILE* fp);
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "record.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Record file signature and format version
+#define RECORD_MAGIC   "swkbdrec"
+#define RECORD_VERSION 1
+
+/** Record file header. */
+struct record_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+// Record file, NULL if recording is disabled
+static FILE* record_file;
+
+bool record_open(const char* path)
+{
+    struct record_header hdr;
+
+    record_file = fopen(path, "wb");
+    if (!record_file) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to create record file %s: [%i] %s\n", path,
+                ec, strerror(ec));
+        return false;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RECORD_MAGIC, sizeof(hdr.magic));
+    hdr.version = RECORD_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, record_file);
+
+    return true;
+}
+
+void record_write(uint32_t type, const void* payload, size_t len)
+{
+    if (record_file) {
+        struct record_frame frame = {
+            .timestamp = metrics_now(),
+            .len = len,
+            .type = type,
+        };
+        fwrite(&frame, sizeof(frame), 1, record_file);
+        fwrite(payload, 1, len, record_file);
+    }
+}
+
+void record_flush(void)
+{
+    if (record_file) {
+        fflush(record_file);
+    }
+}
+
+void record_close(void)
+{
+    if (record_file) {
+        fclose(record_file);
+        record_file = NULL;
+    }
+}
+
+bool record_map(struct record_reader* reader, const char* path)
+{
+    struct stat st;
+    const struct record_header* hdr;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to open record file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(*hdr)) {
+        fprintf(stderr, "Invalid record file %s\n", path);
+        close(fd);
+        return false;
+    }
+
+    reader->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->data == MAP_FAILED) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to map record file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        return false;
+    }
+    reader->size = st.st_size;
+    reader->pos = sizeof(*hdr);
+
+    hdr = (const struct record_header*)reader->data;
+    if (memcmp(hdr->magic, RECORD_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != RECORD_VERSION) {
+        fprintf(stderr, "Invalid record file %s\n", path);
+        record_unmap(reader);
+        return false;
+    }
+
+    return true;
+}
+
+bool record_next(struct record_reader* reader, struct record_frame* frame,
+                 const char** payload)
+{
+    if (reader->size - reader->pos < sizeof(*frame)) {
+        return false;
+    }
+    memcpy(frame, reader->data + reader->pos, sizeof(*frame));
+    if (reader->size - reader->pos - sizeof(*frame) < frame->len) {
+        return false; // truncated
+    }
+    *payload = (const char*)reader->data + reader->pos + sizeof(*frame);
+    reader->pos += sizeof(*frame) + frame->len;
+    return true;
+}
+
+void record_unmap(struct record_reader* reader)
+{
+    munmap((void*)reader->data, reader->size);
+    reader->data = NULL;
+    reader->size = 0;
+}
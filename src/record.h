@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Bit of the frame type set for messages sent by the daemon. */
+#define RECORD_SENT_BIT 0x40000000
+
+/**
+ * Frame header.
+ * The record file is a file header followed by frames: frame header and
+ * IPC message payload, without any padding.
+ */
+struct record_frame {
+    uint64_t timestamp; ///< monotonic time, nanoseconds
+    uint32_t len;       ///< payload size in bytes
+    uint32_t type;      ///< IPC message type, RECORD_SENT_BIT for sent ones
+};
+
+/** Record file reader. */
+struct record_reader {
+    const uint8_t* data; ///< mapped file
+    size_t size;         ///< size of the file
+    size_t pos;          ///< offset of the next frame
+};
+
+/**
+ * Start recording IPC messages.
+ * @param[in] path path to the record file
+ * @return false on errors
+ */
+bool record_open(const char* path);
+
+/**
+ * Write IPC message to the record file (if recording is enabled).
+ * @param[in] type IPC message type, RECORD_SENT_BIT for sent messages
+ * @param[in] payload message payload
+ * @param[in] len payload size in bytes
+ */
+void record_write(uint32_t type, const void* payload, size_t len);
+
+/**
+ * Flush buffered frames to the record file.
+ */
+void record_flush(void);
+
+/**
+ * Stop recording.
+ */
+void record_close(void);
+
+/**
+ * Map record file to memory.
+ * @param[out] reader record file reader
+ * @param[in] path path to the record file
+ * @return false on errors
+ */
+bool record_map(struct record_reader* reader, const char* path);
+
+/**
+ * Get the next frame from the record file.
+ * @param[in] reader record file reader
+ * @param[out] frame frame header
+ * @param[out] payload pointer to the payload inside the mapped file
+ * @return false if there are no more frames
+ */
+bool record_next(struct record_reader* reader, struct record_frame* frame,
+                 const char** payload);
+
+/**
+ * Unmap record file.
+ * @param[in] reader record file reader
+ */
+void record_unmap(struct record_reader* reader);
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "rules.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool rules_add(struct rules* rules, char* line)
+{
+    struct matcher* matcher;
+    char* pattern;
+    char* end;
+    long layout;
+
+    // key
+    pattern = line + strcspn(line, " \t");
+    if (!*pattern) {
+        return false;
+    }
+    *pattern++ = 0;
+    if (strcmp(line, "app_id") == 0 || strcmp(line, "class") == 0) {
+        matcher = &rules->app;
+    } else if (strcmp(line, "title") == 0) {
+        matcher = &rules->title;
+    } else {
+        return false;
+    }
+
+    // layout is the last word, everything between is the pattern
+    end = pattern + strlen(pattern);
+    while (end > pattern && isspace((unsigned char)end[-1])) {
+        --end;
+    }
+    *end = 0;
+    while (end > pattern && !isspace((unsigned char)end[-1])) {
+        --end;
+    }
+    errno = 0;
+    layout = strtol(end, NULL, 10);
+    if (errno || layout < 0 || !isdigit((unsigned char)*end)) {
+        return false;
+    }
+    while (end > pattern && isspace((unsigned char)end[-1])) {
+        --end;
+    }
+    *end = 0;
+    pattern += strspn(pattern, " \t");
+    if (!*pattern) {
+        return false;
+    }
+
+    if (!matcher_add(matcher, pattern, layout)) {
+        fprintf(stderr, "Not enough memory\n");
+        return false;
+    }
+    return true;
+}
+
+bool rules_load(struct rules* rules, const char* path)
+{
+    char line[1024];
+    size_t num = 0;
+    bool rc = true;
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        const int ec = errno;
+        fprintf(stderr, "Unable to open rules file %s: [%i] %s\n", path, ec,
+                strerror(ec));
+        return false;
+    }
+
+    while (rc && fgets(line, sizeof(line), fp)) {
+        char* rule = line + strspn(line, " \t");
+        ++num;
+        rule[strcspn(rule, "\r\n")] = 0;
+        if (*rule && *rule != '#' && !rules_add(rules, rule)) {
+            fprintf(stderr, "Invalid rule at %s:%zu\n", path, num);
+            rc = false;
+        }
+    }
+
+    fclose(fp);
+    return rc;
+}
+
+int rules_find(const struct rules* rules, const char* app_id,
+               const char* title)
+{
+    const int layout = matcher_find(&rules->title, title);
+    if (layout != MATCHER_NONE) {
+        return layout;
+    }
+    return matcher_find(&rules->app, app_id);
+}
+
+void rules_free(struct rules* rules)
+{
+    matcher_free(&rules->app);
+    matcher_free(&rules->title);
+}
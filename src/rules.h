@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include "matcher.h"
+
+#include <stdbool.h>
+
+/** Set of rules of initial layouts. */
+struct rules {
+    struct matcher app;   ///< rules for application ids and window classes
+    struct matcher title; ///< rules for window titles
+};
+
+/**
+ * Parse rule definition and add it to the set.
+ * Rule format is "app_id|class|title PATTERN LAYOUT", where PATTERN is an
+ * exact string or a prefix followed by '*'.
+ * @param[in] rules set of rules
+ * @param[in] line rule definition, modified by the function
+ * @return false if the rule is invalid
+ */
+bool rules_add(struct rules* rules, char* line);
+
+/**
+ * Load rules of initial layouts from the file.
+ * Each line of the file defines a rule, see rules_add for the format. Empty
+ * lines and lines starting with '#' are ignored.
+ * @param[in] rules set of rules
+ * @param[in] path path to the rules file
+ * @return false on errors
+ */
+bool rules_load(struct rules* rules, const char* path);
+
+/**
+ * Find layout for the window.
+ * Title rules take precedence over application rules.
+ * @param[in] rules set of rules
+ * @param[in] app_id application id (X11 class for XWayland windows), can be
+ *                   NULL
+ * @param[in] title window title, can be NULL
+ * @return layout index, -1 if no rule matched
+ */
+int rules_find(const struct rules* rules, const char* app_id,
+               const char* title);
+
+/**
+ * Free resources of the rules.
+ * @param[in] rules set of rules
+ */
+void rules_free(struct rules* rules);
@@ -2,12 +2,24 @@
 // Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
 
 #include "sway.h"
+#include "buffer.h"
+#include "event.h"
+#include "inputs.h"
+#include "loop.h"
+#include "metrics.h"
+#include "record.h"
+#include "trace.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <json.h>
@@ -19,8 +31,13 @@ static const uint8_t ipc_magic[] = { 'i', '3', '-', 'i', 'p', 'c' };
 enum ipc_msg_type {
     IPC_COMMAND = 0,
     IPC_SUBSCRIBE = 2,
+    IPC_GET_TREE = 4,
+    IPC_GET_INPUTS = 100,
 };
 
+/** Bit of the message type set for events */
+#define IPC_EVENT_BIT 0x80000000
+
 /** IPC header */
 struct __attribute__((__packed__)) ipc_header {
     uint8_t magic[sizeof(ipc_magic)];
@@ -28,6 +45,107 @@ struct __attribute__((__packed__)) ipc_header {
     uint32_t type;
 };
 
+/** Initial size of the event receive buffer */
+#define IPC_BUF_SIZE 16384
+/** Size of the chunk to read replies */
+#define CMD_RECV_SIZE 1024
+
+/** Max number of commands waiting for reply */
+#define CMD_PENDING_MAX 32
+/** Delay before the first reconnection attempt, milliseconds */
+#define RECONNECT_DELAY_MIN 100
+/** Max delay between reconnection attempts, milliseconds */
+#define RECONNECT_DELAY_MAX 5000
+
+/** Max gap between recorded events replayed as one burst, nanoseconds */
+#define REPLAY_BURST_GAP 1000000
+
+/** Max number of layout changes expected from sent commands */
+#define EXPECT_MAX CMD_PENDING_MAX
+
+/** Max number of events handled per wakeup, the rest waits for the loop */
+#define EVENTS_PER_WAKEUP 64
+
+/** Number of layouts with precomputed command frames (max XKB groups) */
+#define CMD_FRAMES_NUM 4
+
+/** Command frame: IPC header and payload ready to send. */
+struct cmd_frame {
+    struct buffer buf;
+    size_t len; ///< size of the frame, 0 if there is nothing to send
+};
+
+/** Command waiting for reply. */
+struct cmd_pending {
+    int layout;         ///< requested layout
+    uint64_t timestamp; ///< send time, microseconds
+    bool expected;      ///< layout change is expected from the command
+};
+
+// Event handlers
+static on_focus handle_focus;
+static on_title handle_title;
+static on_close handle_close;
+static on_workspace handle_workspace;
+static on_layout handle_layout;
+static on_sync handle_sync;
+// Mask of handled event types, the rest are not subscribed
+static uint32_t events_mask;
+
+// Receive buffer for the event channel
+static struct buffer ipc_buf;
+
+// Command channel: separate non-blocking IPC connection used for commands
+static int cmd_sock = -1;
+// Precomputed frames of layout switch commands, rebuilt on keyboards change
+static struct cmd_frame cmd_frames[CMD_FRAMES_NUM + 1 /* temporary */];
+// Output queue: commands not written yet
+static struct buffer cmd_queue;
+static size_t cmd_queue_len;
+static size_t cmd_queue_last; // size of the last command if nothing is sent
+static bool cmd_wait_out; // waiting for the socket to become writable
+// Input buffer: partially received replies
+static struct buffer cmd_buf;
+static size_t cmd_buf_len;
+// Commands waiting for reply (ring buffer), replies come in request order
+static struct cmd_pending cmd_pending[CMD_PENDING_MAX];
+static size_t cmd_pending_head;
+static size_t cmd_pending_num;
+// Layout to set when a reply frees the pending slot, -1 if none
+static int cmd_deferred = -1;
+
+// Event channel
+static int event_sock = -1;
+
+// Reconnection timer and current delay before the next attempt
+static int reconnect_timer = -1;
+static size_t reconnect_delay;
+
+// IPC statistics
+static struct sway_stats stats;
+
+// Layout passed to the handler last time, used to collapse the same events
+// from multiple keyboards
+static int active_layout = -1;
+// Keyboards have different active layouts
+static bool layouts_diverged;
+// Layout changes expected from sent commands (ring buffer), in order of
+// sending: used to distinguish own changes from the user ones
+static int expected[EXPECT_MAX];
+static size_t expected_head;
+static size_t expected_num;
+
+/**
+ * Get current monotonic time.
+ * @return timestamp in microseconds
+ */
+static uint64_t timestamp_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * Read exactly specified number of bytes from socket.
  * @param[in] sock socket descriptor
@@ -55,7 +173,7 @@ static int sock_read(int sock, void* buf, size_t len)
 }
 
 /**
- * Write data to the socket.
+ * Write data to the socket, a closed peer is reported as EPIPE.
  * @param[in] sock socket descriptor
  * @param[in] buf buffer of data of send
  * @param[in] len number of bytes to write
@@ -64,7 +182,7 @@ static int sock_read(int sock, void* buf, size_t len)
 static int sock_write(int sock, const void* buf, size_t len)
 {
     while (len) {
-        const ssize_t rcv = write(sock, buf, len);
+        const ssize_t rcv = send(sock, buf, len, MSG_NOSIGNAL);
         if (rcv == -1) {
             const int ec = errno;
             fprintf(stderr, "IPC write error: [%i] %s\n", ec, strerror(ec));
@@ -76,36 +194,41 @@ static int sock_write(int sock, const void* buf, size_t len)
     return 0;
 }
 
+/**
+ * Check if the socket has already received data available for reading.
+ * @param[in] sock socket descriptor
+ * @return true if the next read will not wait for new data
+ */
+static bool sock_pending(int sock)
+{
+    uint8_t byte;
+    return recv(sock, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
 /**
  * Read IPC message.
  * @param[in] sock socket descriptor
- * @return IPC response as json object, NULL on errors
+ * @param[out] type message type
+ * @return IPC response as null-terminated string (valid until the next
+ *         read), NULL on errors
  */
-static struct json_object* ipc_read(int sock)
+static char* ipc_read(int sock, uint32_t* type)
 {
     struct ipc_header hdr;
     if (sock_read(sock, &hdr, sizeof(hdr))) {
         return NULL;
     }
-    char* raw = malloc(hdr.len + 1);
-    if (!raw) {
-        fprintf(stderr, "Not enough memory\n");
-        return NULL;
-    }
-    if (sock_read(sock, raw, hdr.len)) {
-        free(raw);
-        return NULL;
-    }
-    raw[hdr.len] = 0;
 
-    struct json_object* response = json_tokener_parse(raw);
-    if (!response) {
-        fprintf(stderr, "Invalid IPC response\n");
+    if (!buf_reserve(&ipc_buf, hdr.len + 1 /* last null */) ||
+        sock_read(sock, ipc_buf.data, hdr.len)) {
+        return NULL;
     }
+    ipc_buf.data[hdr.len] = 0;
+    *type = hdr.type;
 
-    free(raw);
+    record_write(hdr.type, ipc_buf.data, hdr.len);
 
-    return response;
+    return ipc_buf.data;
 }
 
 /**
@@ -172,6 +295,213 @@ static int ipc_connect(void)
     return sock;
 }
 
+/**
+ * Fill the registry with keyboards from the GET_INPUTS reply.
+ * @param[in] raw reply message
+ * @param[out] layout currently active layout, -1 if unknown
+ * @return error code, 0 on success
+ */
+static int load_keyboards(const char* raw, int* layout)
+{
+    struct json_object* response = json_tokener_parse(raw);
+    *layout = -1;
+    if (!response) {
+        fprintf(stderr, "Invalid IPC response\n");
+        return EIO;
+    }
+
+    clear_keyboards();
+    const size_t num = json_object_array_length(response);
+    for (size_t i = 0; i < num; ++i) {
+        struct json_object* input;
+        struct json_object* id;
+        struct json_object* val;
+        input = json_object_array_get_idx(response, i);
+        if (json_object_object_get_ex(input, "type", &val) &&
+            strcmp(json_object_get_string(val), "keyboard") == 0 &&
+            json_object_object_get_ex(input, "identifier", &id) &&
+            json_object_object_get_ex(input, "xkb_layout_names", &val)) {
+            const int layouts = json_object_array_length(val);
+            int active = -1;
+            if (json_object_object_get_ex(input, "xkb_active_layout_index",
+                                          &val)) {
+                active = json_object_get_int(val);
+            }
+            put_keyboard(json_object_get_string(id), layouts, active);
+            // take the active layout of the first switchable keyboard
+            if (*layout < 0 && layouts > 1) {
+                *layout = active;
+            }
+        }
+    }
+    json_object_put(response);
+
+    active_layout = *layout;
+    layouts_diverged = false;
+
+    return 0;
+}
+
+/**
+ * Fill the registry with currently connected keyboards.
+ * @param[in] sock socket descriptor
+ * @param[out] layout currently active layout, -1 if unknown
+ * @return error code, 0 on success
+ */
+static int ipc_get_keyboards(int sock, int* layout)
+{
+    int rc = ipc_write(sock, IPC_GET_INPUTS, NULL);
+    *layout = -1;
+    if (rc == 0) {
+        uint32_t type;
+        const char* raw = ipc_read(sock, &type);
+        rc = raw ? load_keyboards(raw, layout) : EIO;
+    }
+    return rc;
+}
+
+/** Windows and focus collected from the layout tree. */
+struct tree_info {
+    struct sway_window* list; ///< array of windows
+    size_t num;               ///< number of windows in the array
+    size_t size;              ///< size of the array
+    const char* workspace;    ///< name of the focused workspace
+    const char* output;       ///< output of the focused workspace
+};
+
+/**
+ * Get string member of the JSON object.
+ * @param[in] node JSON object
+ * @param[in] key name of the member
+ * @return string value, NULL if not present
+ */
+static const char* json_string(struct json_object* node, const char* key)
+{
+    struct json_object* val;
+    return json_object_object_get_ex(node, key, &val) ?
+        json_object_get_string(val) : NULL;
+}
+
+/**
+ * Collect windows from the layout tree node recursively.
+ * @param[in] node tree node
+ * @param[in] workspace name of the workspace containing the node
+ * @param[in] output name of the output containing the node
+ * @param[in,out] info collected windows and focus
+ * @return false if not enough memory
+ */
+static bool collect_windows(struct json_object* node, const char* workspace,
+                            const char* output, struct tree_info* info)
+{
+    static const char* const children[] = { "nodes", "floating_nodes" };
+    const char* type = json_string(node, "type");
+    struct json_object* val;
+    bool has_children = false;
+    bool focused = false;
+
+    if (type && strcmp(type, "output") == 0) {
+        output = json_string(node, "name");
+    } else if (type && strcmp(type, "workspace") == 0) {
+        workspace = json_string(node, "name");
+    }
+    if (json_object_object_get_ex(node, "focused", &val)) {
+        focused = json_object_get_boolean(val);
+    }
+    if (focused) {
+        info->workspace = workspace;
+        info->output = output;
+    }
+
+    for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); ++i) {
+        if (json_object_object_get_ex(node, children[i], &val)) {
+            const size_t cnum = json_object_array_length(val);
+            for (size_t j = 0; j < cnum; ++j) {
+                has_children = true;
+                if (!collect_windows(json_object_array_get_idx(val, j),
+                                     workspace, output, info)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // leaf container is a window
+    if (!has_children && type &&
+        (strcmp(type, "con") == 0 || strcmp(type, "floating_con") == 0)) {
+        if (info->num == info->size) {
+            const size_t new_size = info->size ? info->size * 2 : 64;
+            struct sway_window* ptr =
+                realloc(info->list, new_size * sizeof(*info->list));
+            if (!ptr) {
+                return false;
+            }
+            info->list = ptr;
+            info->size = new_size;
+        }
+        struct sway_window* wnd = &info->list[info->num++];
+        memset(wnd, 0, sizeof(*wnd));
+        if (json_object_object_get_ex(node, "id", &val)) {
+            wnd->id = json_object_get_int(val);
+        }
+        wnd->title = json_string(node, "name");
+        wnd->app_id = json_string(node, "app_id");
+        if (!wnd->app_id &&
+            json_object_object_get_ex(node, "window_properties", &val)) {
+            wnd->app_id = json_string(val, "class"); // XWayland window
+        }
+        wnd->focused = focused;
+    }
+
+    return true;
+}
+
+/**
+ * Pass windows from the GET_TREE reply to the sync handler.
+ * @param[in] raw reply message
+ * @param[in] layout currently active layout
+ * @return error code, 0 on success
+ */
+static int load_tree(const char* raw, int layout)
+{
+    struct json_object* response = json_tokener_parse(raw);
+    struct tree_info info;
+    int rc = 0;
+
+    if (!response) {
+        fprintf(stderr, "Invalid IPC response\n");
+        return EIO;
+    }
+
+    memset(&info, 0, sizeof(info));
+    if (collect_windows(response, NULL, NULL, &info)) {
+        handle_sync(info.list, info.num, info.workspace, info.output, layout);
+    } else {
+        fprintf(stderr, "Not enough memory\n");
+        rc = ENOMEM;
+    }
+    free(info.list);
+    json_object_put(response);
+
+    return rc;
+}
+
+/**
+ * Get list of existing windows and pass it to the sync handler.
+ * @param[in] sock socket descriptor
+ * @param[in] layout currently active layout
+ * @return error code, 0 on success
+ */
+static int ipc_get_tree(int sock, int layout)
+{
+    int rc = ipc_write(sock, IPC_GET_TREE, NULL);
+    if (rc == 0) {
+        uint32_t type;
+        const char* raw = ipc_read(sock, &type);
+        rc = raw ? load_tree(raw, layout) : EIO;
+    }
+    return rc;
+}
+
 /**
  * Subscribe to Sway events.
  * @param[in] sock socket descriptor
@@ -179,11 +509,19 @@ static int ipc_connect(void)
  */
 static int ipc_subscribe(int sock)
 {
-    const char* subscribe = "[ \"window\", \"input\" ]";
-    int rc = ipc_write(sock, IPC_SUBSCRIBE, subscribe);
+    char subscribe[64];
+    int rc;
+
+    if (!event_subscription(events_mask, subscribe, sizeof(subscribe))) {
+        return EINVAL;
+    }
+    rc = ipc_write(sock, IPC_SUBSCRIBE, subscribe);
     if (rc == 0) {
-        struct json_object* response = ipc_read(sock);
+        uint32_t type;
+        char* raw = ipc_read(sock, &type);
+        struct json_object* response = raw ? json_tokener_parse(raw) : NULL;
         if (!response) {
+            fprintf(stderr, "Invalid IPC response\n");
             rc = EIO;
         } else {
             struct json_object* val;
@@ -199,121 +537,823 @@ static int ipc_subscribe(int sock)
 }
 
 /**
- * Set keyboard layout.
- * @param[in] sock socket descriptor
+ * Check if the keyboard can be switched to the layout.
+ * @param[in] kbd keyboard description
+ * @param[in] layout keyboard layout index
+ * @return true if the keyboard has the layout
+ */
+static inline bool kbd_has_layout(const struct keyboard* kbd, int layout)
+{
+    return kbd->layouts > 1 && kbd->layouts > layout;
+}
+
+/**
+ * Build command frame to switch keyboard layout.
+ * The command targets only keyboards that have the specified layout,
+ * all keyboards are used if the list of keyboards is unknown.
+ * @param[out] frame command frame
  * @param[in] layout keyboard layout index to set
+ * @return false if not enough memory
+ */
+static bool cmd_build(struct cmd_frame* frame, int layout)
+{
+    static const char cmd[] = "input \"%s\" xkb_switch_layout %i";
+    static const char cmd_all[] = "input type:keyboard xkb_switch_layout %i";
+    const struct keyboard* kbd;
+    const size_t kbd_num = get_keyboards(&kbd);
+
+    // estimate size of the frame
+    size_t max = sizeof(struct ipc_header) + sizeof(cmd_all) + 16;
+    for (size_t i = 0; i < kbd_num; ++i) {
+        max += sizeof(cmd) + strlen(kbd[i].id) + 16;
+    }
+    if (!buf_reserve(&frame->buf, max)) {
+        frame->len = 0;
+        return false;
+    }
+
+    char* payload = frame->buf.data + sizeof(struct ipc_header);
+    max -= sizeof(struct ipc_header);
+    size_t len = 0;
+    if (kbd_num == 0) {
+        len = snprintf(payload, max, cmd_all, layout);
+    } else {
+        for (size_t i = 0; i < kbd_num; ++i) {
+            if (kbd_has_layout(&kbd[i], layout)) {
+                if (len) {
+                    payload[len++] = ';';
+                }
+                len += snprintf(payload + len, max - len, cmd, kbd[i].id,
+                                layout);
+            }
+        }
+    }
+
+    if (len == 0) {
+        frame->len = 0; // no keyboards with such layout
+    } else {
+        struct ipc_header hdr;
+        memcpy(hdr.magic, ipc_magic, sizeof(ipc_magic));
+        hdr.len = len;
+        hdr.type = IPC_COMMAND;
+        memcpy(frame->buf.data, &hdr, sizeof(hdr));
+        frame->len = sizeof(hdr) + len;
+    }
+
+    return true;
+}
+
+/**
+ * Rebuild precomputed frames of layout switch commands.
+ */
+static void cmd_rebuild(void)
+{
+    for (int i = 0; i < CMD_FRAMES_NUM; ++i) {
+        cmd_build(&cmd_frames[i], i);
+    }
+}
+
+/**
+ * Write queued commands to the command channel without blocking.
  * @return error code, 0 on success
  */
-static int ipc_change_layout(int sock, int layout)
+static int cmd_flush(void)
 {
-    char cmd[64];
-    snprintf(cmd, sizeof(cmd), "input * xkb_switch_layout %i", layout);
-    return ipc_write(sock, IPC_COMMAND, cmd);
+    size_t sent = 0;
+    while (sent < cmd_queue_len) {
+        const ssize_t rc = send(cmd_sock, cmd_queue.data + sent,
+                                cmd_queue_len - sent, MSG_NOSIGNAL);
+        if (rc == -1) {
+            const int ec = errno;
+            if (ec == EAGAIN || ec == EWOULDBLOCK) {
+                break; // continue when the socket becomes writable
+            }
+            if (ec == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "IPC write error: [%i] %s\n", ec, strerror(ec));
+            return ec;
+        }
+        sent += rc;
+    }
+    cmd_queue_len -= sent;
+    memmove(cmd_queue.data, cmd_queue.data + sent, cmd_queue_len);
+    if (cmd_queue_len < cmd_queue_last) {
+        cmd_queue_last = 0; // sending of the last command started
+    }
+
+    // watch for the socket writability only while the queue is not empty
+    if (cmd_wait_out != (cmd_queue_len != 0)) {
+        cmd_wait_out = !cmd_wait_out;
+        return loop_modify(cmd_sock, EPOLLIN | (cmd_wait_out ? EPOLLOUT : 0));
+    }
+
+    return 0;
+}
+
+/**
+ * Register layout change expected as a result of the switch command.
+ * @param[in] layout keyboard layout index to set
+ * @return true if the change is registered, false if no change expected
+ */
+static bool expect_layout(int layout)
+{
+    // layout that keyboards will have after all sent commands
+    const int last = expected_num ?
+        expected[(expected_head + expected_num - 1) % EXPECT_MAX] :
+        active_layout;
+    if (layout == last) {
+        return false; // no change, no event
+    }
+    if (expected_num == EXPECT_MAX) {
+        expected_head = (expected_head + 1) % EXPECT_MAX; // drop the oldest
+        --expected_num;
+    }
+    expected[(expected_head + expected_num) % EXPECT_MAX] = layout;
+    ++expected_num;
+    return true;
 }
 
 /**
- * Get container info from event message.
- * @param[in] msg event message
- * @param[out] wnd_id identifier of currently focused window (container)
- * @param[out] app_id application id
- * @param[out] title title of the window
+ * Check if the layout change was caused by a sent command.
+ * Expectations preceding the matched one are dropped too: the commands
+ * produced no change (keyboards already had the layout) or failed.
+ * @param[in] layout new keyboard layout index
+ * @return true if the change was expected
  */
-static void container_info(struct json_object* msg, int* wnd_id,
-                           const char** app_id, const char** title)
+static bool expected_change(int layout)
 {
-    struct json_object* cnt_node;
-    struct json_object* sub_node;
+    for (size_t i = 0; i < expected_num; ++i) {
+        if (expected[(expected_head + i) % EXPECT_MAX] == layout) {
+            expected_head = (expected_head + i + 1) % EXPECT_MAX;
+            expected_num -= i + 1;
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (!json_object_object_get_ex(msg, "container", &cnt_node)) {
+/**
+ * Set keyboard layout: send the command to the command channel.
+ * @param[in] layout keyboard layout index to set
+ * @return error code, 0 on success
+ */
+static int cmd_switch_layout(int layout)
+{
+    struct cmd_frame* frame;
+
+    if (layout < CMD_FRAMES_NUM) {
+        frame = &cmd_frames[layout];
+    } else {
+        frame = &cmd_frames[CMD_FRAMES_NUM];
+        cmd_build(frame, layout);
+    }
+    if (frame->len == 0) {
+        return 0;
+    }
+
+    if (cmd_queue_last) {
+        // the previous command is still in the queue (the socket is full),
+        // replace it: its layout is superseded by the new one
+        const size_t last = (cmd_pending_head + cmd_pending_num - 1) %
+            CMD_PENDING_MAX;
+        if (cmd_pending[last].expected && expected_num &&
+            expected[(expected_head + expected_num - 1) % EXPECT_MAX] ==
+                cmd_pending[last].layout) {
+            --expected_num;
+        }
+        --cmd_pending_num;
+        --stats.commands;
+        ++stats.collapsed;
+        cmd_queue_len -= cmd_queue_last;
+        cmd_queue_last = 0;
+    }
+
+    if (cmd_pending_num == CMD_PENDING_MAX) {
+        // compositor doesn't reply, send only the latest layout later
+        if (cmd_deferred >= 0) {
+            ++stats.collapsed;
+        }
+        cmd_deferred = layout;
+        return 0;
+    }
+    if (!buf_reserve(&cmd_queue, cmd_queue_len + frame->len)) {
+        return ENOMEM;
+    }
+
+    struct cmd_pending* pending =
+        &cmd_pending[(cmd_pending_head + cmd_pending_num) % CMD_PENDING_MAX];
+    pending->layout = layout;
+    pending->timestamp = timestamp_us();
+    ++cmd_pending_num;
+    ++stats.commands;
+
+    memcpy(cmd_queue.data + cmd_queue_len, frame->buf.data, frame->len);
+    cmd_queue_len += frame->len;
+    cmd_queue_last = frame->len;
+
+    pending->expected = expect_layout(layout);
+    trace_put(TRACE_COMMAND, 0, 0, layout);
+
+    record_write(IPC_COMMAND | RECORD_SENT_BIT,
+                 frame->buf.data + sizeof(struct ipc_header),
+                 frame->len - sizeof(struct ipc_header));
+
+    return cmd_flush();
+}
+
+/**
+ * Handle command reply.
+ * @param[in] msg reply message
+ */
+static void cmd_reply(char* msg)
+{
+    const char* error = NULL;
+    const bool success = reply_parse(msg, &error);
+
+    if (cmd_pending_num == 0) {
+        fprintf(stderr, "Unexpected IPC command reply\n");
         return;
     }
-    if (wnd_id && json_object_object_get_ex(cnt_node, "id", &sub_node)) {
-        *wnd_id = json_object_get_int(sub_node);
+    const struct cmd_pending* pending = &cmd_pending[cmd_pending_head];
+    cmd_pending_head = (cmd_pending_head + 1) % CMD_PENDING_MAX;
+    --cmd_pending_num;
+
+    stats.latency_last = timestamp_us() - pending->timestamp;
+    stats.latency_total += stats.latency_last;
+    if (stats.latency_max < stats.latency_last) {
+        stats.latency_max = stats.latency_last;
+    }
+
+    if (!success) {
+        ++stats.failures;
+        fprintf(stderr, "Failed to set layout %i: %s\n", pending->layout,
+                error ? error : "invalid reply");
+    }
+}
+
+/**
+ * Read replies from the command channel without blocking.
+ * @return error code, 0 on success
+ */
+static int cmd_receive(void)
+{
+    while (1) {
+        if (!buf_reserve(&cmd_buf, cmd_buf_len + CMD_RECV_SIZE)) {
+            return ENOMEM;
+        }
+        const ssize_t rcv = recv(cmd_sock, cmd_buf.data + cmd_buf_len,
+                                 cmd_buf.size - cmd_buf_len, 0);
+        if (rcv == 0) {
+            fprintf(stderr, "IPC read error: no data\n");
+            return ENOMSG;
+        }
+        if (rcv == -1) {
+            const int ec = errno;
+            if (ec == EAGAIN || ec == EWOULDBLOCK) {
+                break;
+            }
+            if (ec == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "IPC read error: [%i] %s\n", ec, strerror(ec));
+            return ec;
+        }
+        cmd_buf_len += rcv;
+    }
+
+    // handle all completely received replies
+    size_t pos = 0;
+    while (cmd_buf_len - pos >= sizeof(struct ipc_header)) {
+        struct ipc_header hdr;
+        memcpy(&hdr, cmd_buf.data + pos, sizeof(hdr));
+        const size_t frame_len = sizeof(hdr) + hdr.len;
+        if (cmd_buf_len - pos < frame_len) {
+            break;
+        }
+        if (!buf_reserve(&cmd_buf, cmd_buf_len + 1 /* last null */)) {
+            return ENOMEM;
+        }
+        char* msg = cmd_buf.data + pos + sizeof(hdr);
+        const char next = msg[hdr.len];
+        msg[hdr.len] = 0;
+        cmd_reply(msg);
+        msg[hdr.len] = next;
+        pos += frame_len;
     }
-    if (app_id && json_object_object_get_ex(cnt_node, "app_id", &sub_node)) {
-        *app_id = json_object_get_string(sub_node);
+    cmd_buf_len -= pos;
+    memmove(cmd_buf.data, cmd_buf.data + pos, cmd_buf_len);
+
+    if (cmd_deferred >= 0 && cmd_pending_num < CMD_PENDING_MAX) {
+        const int layout = cmd_deferred;
+        cmd_deferred = -1;
+        return cmd_switch_layout(layout);
+    }
+
+    return 0;
+}
+
+/**
+ * Open command channel.
+ * @return error code, 0 on success
+ */
+static int cmd_connect(void)
+{
+    const int sock = ipc_connect();
+    if (sock < 0) {
+        return -sock;
     }
-    if (title && json_object_object_get_ex(cnt_node, "name", &sub_node)) {
-        *title = json_object_get_string(sub_node);
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == -1) {
+        const int ec = errno;
+        fprintf(stderr, "Failed to setup IPC socket: [%i] %s\n", ec,
+                strerror(ec));
+        close(sock);
+        return ec;
     }
+    cmd_sock = sock;
+
+    cmd_rebuild();
+
+    return 0;
+}
+
+/**
+ * Get application id of the window from the event.
+ * @param[in] ev event description
+ * @return application id, X11 class for XWayland windows
+ */
+static const char* event_app(const struct event* ev)
+{
+    return ev->app_id ? ev->app_id : ev->wnd_class;
 }
 
 /**
- * Get keyboard layout index from event message.
- * @param[in] msg event message
- * @return keyboard layout index or -1 if not found
+ * Event dispatcher: pass the event to its handler.
+ * @param[in] ev event description
+ * @return keyboard layout requested by the handler, -1 if none
  */
-static int layout_index(struct json_object* msg)
+typedef int (*event_dispatcher)(const struct event* ev);
+
+/** Window focus event dispatcher, see event_dispatcher for details. */
+static int dispatch_focus(const struct event* ev)
+{
+    return handle_focus(ev->wnd_id, event_app(ev), ev->title);
+}
+
+/** Window title event dispatcher, see event_dispatcher for details. */
+static int dispatch_title(const struct event* ev)
+{
+    return handle_title(ev->wnd_id, event_app(ev), ev->title);
+}
+
+/** Window close event dispatcher, see event_dispatcher for details. */
+static int dispatch_close(const struct event* ev)
+{
+    return handle_close(ev->wnd_id);
+}
+
+/** Workspace focus event dispatcher, see event_dispatcher for details. */
+static int dispatch_workspace(const struct event* ev)
+{
+    return ev->workspace ? handle_workspace(ev->workspace, ev->output) : -1;
+}
+
+/** Layout change event dispatcher, see event_dispatcher for details. */
+static int dispatch_layout(const struct event* ev)
 {
-    struct json_object* input_node;
-    if (json_object_object_get_ex(msg, "input", &input_node)) {
-        struct json_object* index_node;
-        if (json_object_object_get_ex(input_node, "xkb_active_layout_index",
-                                      &index_node)) {
-            const int idx = json_object_get_int(index_node);
-            if (idx != 0 || errno != EINVAL) {
-                return idx;
+    if (ev->input_id) {
+        put_keyboard(ev->input_id, ev->layouts_num, ev->layout);
+    }
+    if (ev->layout < 0) {
+        return -1;
+    }
+
+    // each keyboard reports the same switch separately
+    if (ev->layout == active_layout) {
+        metrics_count(EVENT_LAYOUT, COUNTER_DUPLICATE);
+    } else {
+        active_layout = ev->layout;
+        if (!expected_change(ev->layout)) {
+            handle_layout(ev->layout); // changed by user
+        } else {
+            ++stats.own_events;
+            trace_put(TRACE_OWN, 0, 0, ev->layout);
+            if (expected_num == 0) {
+                // the last command is applied, report the result in case
+                // the user switched layout in between
+                handle_layout(ev->layout);
             }
         }
     }
+
     return -1;
 }
 
-int sway_monitor(on_focus fn_focus, on_title fn_title,
-                 on_close fn_close, on_layout fn_layout)
+/** Keyboard added/changed event dispatcher, see event_dispatcher. */
+static int dispatch_keyboard(const struct event* ev)
 {
-    int rc;
+    if (ev->input_id && ev->input_type &&
+        strcmp(ev->input_type, "keyboard") == 0) {
+        put_keyboard(ev->input_id, ev->layouts_num, ev->layout);
+        cmd_rebuild();
+    }
+    return -1;
+}
 
-    const int sock = ipc_connect();
-    if (sock < 0) {
-        rc = -sock;
-        goto error;
+/** Input removed event dispatcher, see event_dispatcher for details. */
+static int dispatch_removed(const struct event* ev)
+{
+    if (ev->input_id) {
+        rm_keyboard(ev->input_id);
+        cmd_rebuild();
     }
+    return -1;
+}
 
-    rc = ipc_subscribe(sock);
-    if (rc) {
-        goto error;
+// Dispatchers of the event types
+static const event_dispatcher dispatchers[EVENT_TYPES] = {
+    [EVENT_FOCUS] = dispatch_focus,
+    [EVENT_TITLE] = dispatch_title,
+    [EVENT_CLOSE] = dispatch_close,
+    [EVENT_LAYOUT] = dispatch_layout,
+    [EVENT_KEYMAP] = dispatch_keyboard,
+    [EVENT_ADDED] = dispatch_keyboard,
+    [EVENT_REMOVED] = dispatch_removed,
+    [EVENT_WORKSPACE] = dispatch_workspace,
+};
+
+/**
+ * Pass the event to its handler.
+ * @param[in] ev event description
+ * @return keyboard layout requested by the handler, -1 if none
+ */
+static int dispatch_event(const struct event* ev)
+{
+    const event_dispatcher dispatcher = dispatchers[ev->type];
+    return dispatcher ? dispatcher(ev) : -1;
+}
+
+/**
+ * Check if keyboards got different active layouts, report the change.
+ * Called after handling a burst of events: a single switch produces an event
+ * per keyboard, so layouts are diverged temporarily inside the burst.
+ */
+static void check_divergence(void)
+{
+    const bool diverged = keyboards_diverged();
+    if (diverged != layouts_diverged) {
+        layouts_diverged = diverged;
+        if (diverged) {
+            ++stats.divergences;
+            fprintf(stderr, "Keyboards have different active layouts\n");
+        }
     }
+}
 
-    while (rc == 0) {
-        struct json_object* msg = ipc_read(sock);
+/**
+ * Handle events already received by the event channel, at most
+ * EVENTS_PER_WAKEUP at once: the loop is level-triggered and calls again for
+ * the rest, so other channels and timers are not starved by event floods.
+ * @param[in] sock socket descriptor
+ * @return error code, 0 on success
+ */
+static int handle_events(int sock)
+{
+    // Layout to set after handling all buffered events: bursts of focus
+    // changes are coalesced to the single switch command
+    int layout = -1;
+    enum event_type layout_event = EVENT_NONE;
+    uint64_t layout_ts = 0;
+    size_t count = 0;
+    int rc;
+
+    do {
+        const uint64_t read_ts = metrics_now();
+        uint32_t type;
+        char* msg = ipc_read(sock, &type);
         if (!msg) {
-            rc = EIO;
-        } else {
-            struct json_object* event_node;
-            if (json_object_object_get_ex(msg, "change", &event_node)) {
-                int wnd_id = -1;
-                int layout = -1;
-                const char* app_id = NULL;
-                const char* title = NULL;
-                const char* event_name = json_object_get_string(event_node);
-                if (strcmp(event_name, "focus") == 0) {
-                    container_info(msg, &wnd_id, &app_id, &title);
-                    layout = fn_focus(wnd_id, app_id, title);
-                } else if (strcmp(event_name, "title") == 0) {
-                    container_info(msg, &wnd_id, &app_id, &title);
-                    layout = fn_title(wnd_id, app_id, title);
-                } else if (strcmp(event_name, "close") == 0) {
-                    container_info(msg, &wnd_id, NULL, NULL);
-                    layout = fn_close(wnd_id);
-                } else if (strcmp(event_name, "xkb_layout") == 0) {
-                    layout = layout_index(msg);
-                    if (layout >= 0) {
-                        fn_layout(layout);
-                    }
-                    layout = -1;
-                }
+            return EIO;
+        }
+        if (type & IPC_EVENT_BIT) {
+            struct event ev;
+            const uint64_t parse_ts = metrics_now();
+            if (!event_parse(msg, type & ~IPC_EVENT_BIT, events_mask, &ev)) {
+                fprintf(stderr, "Invalid IPC event\n");
+                metrics_count(EVENT_NONE, COUNTER_SKIPPED);
+                continue;
+            }
+            const uint64_t handle_ts = metrics_now();
+            metrics_stage(ev.type, STAGE_READ, read_ts, parse_ts);
+            metrics_stage(ev.type, STAGE_PARSE, parse_ts, handle_ts);
+            const int req = dispatch_event(&ev);
+            if (ev.type == EVENT_NONE) {
+                metrics_count(EVENT_NONE, COUNTER_SKIPPED);
+                continue;
+            }
+            metrics_count(ev.type, COUNTER_PROCESSED);
+            metrics_stage(ev.type, STAGE_HANDLE, handle_ts, metrics_now());
+            if (req >= 0) {
                 if (layout >= 0) {
-                    ipc_change_layout(sock, layout);
+                    metrics_count(layout_event, COUNTER_COALESCED);
                 }
+                layout = req;
+                layout_event = ev.type;
+                layout_ts = read_ts;
             }
-            json_object_put(msg);
         }
+    } while (++count < EVENTS_PER_WAKEUP && sock_pending(sock));
+
+    record_flush();
+    check_divergence();
+
+    if (layout < 0) {
+        return 0;
     }
+    rc = cmd_switch_layout(layout);
+    metrics_stage(layout_event, STAGE_SWITCH, layout_ts, metrics_now());
+    return rc;
+}
 
-error:
-    if (sock >= 0) {
-        close(sock);
+/**
+ * Close both IPC channels and reset the command channel state.
+ */
+static void disconnect(void)
+{
+    if (event_sock >= 0) {
+        loop_remove(event_sock);
+        close(event_sock);
+        event_sock = -1;
+    }
+    if (cmd_sock >= 0) {
+        loop_remove(cmd_sock);
+        close(cmd_sock);
+        cmd_sock = -1;
     }
+    cmd_queue_len = 0;
+    cmd_queue_last = 0;
+    cmd_deferred = -1;
+    cmd_buf_len = 0;
+    cmd_wait_out = false;
+    cmd_pending_head = 0;
+    cmd_pending_num = 0;
+    expected_head = 0;
+    expected_num = 0;
+}
+
+/**
+ * Handle connection loss: close channels and schedule reconnection.
+ */
+static void reconnect(void)
+{
+    disconnect();
+    reconnect_delay = RECONNECT_DELAY_MIN;
+    fprintf(stderr, "IPC connection lost, reconnect in %zu ms\n",
+            reconnect_delay);
+    loop_timer_set(reconnect_timer, reconnect_delay);
+}
+
+/** Event channel handler, see loop_fd_cb for details. */
+static int on_event_channel(int fd, uint32_t events, void* data)
+{
+    (void)events;
+    (void)data;
+    if (handle_events(fd)) {
+        reconnect();
+    }
+    return 0;
+}
+
+/** Command channel handler, see loop_fd_cb for details. */
+static int on_command_channel(int fd, uint32_t events, void* data)
+{
+    int rc = 0;
+
+    (void)fd;
+    (void)data;
+
+    if (events & EPOLLOUT) {
+        rc = cmd_flush();
+    }
+    if (rc == 0 && (events & ~EPOLLOUT)) {
+        rc = cmd_receive();
+    }
+    if (rc) {
+        reconnect();
+    }
+
+    return 0;
+}
+
+/**
+ * Connect to Sway, synchronize state and start monitoring.
+ * @return error code, 0 on success
+ */
+static int connect_channels(void)
+{
+    int layout;
+    int rc;
+
+    event_sock = ipc_connect();
+    if (event_sock < 0) {
+        rc = -event_sock;
+        event_sock = -1;
+        return rc;
+    }
+
+    // synchronize state with the compositor: events are not received yet,
+    // so everything that happened before subscription is covered
+    rc = ipc_get_keyboards(event_sock, &layout);
+    if (rc == 0) {
+        rc = ipc_get_tree(event_sock, layout);
+    }
+    if (rc == 0) {
+        rc = ipc_subscribe(event_sock);
+    }
+    if (rc == 0) {
+        rc = cmd_connect();
+    }
+    if (rc == 0) {
+        rc = loop_add(event_sock, EPOLLIN, on_event_channel, NULL);
+    }
+    if (rc == 0) {
+        rc = loop_add(cmd_sock, EPOLLIN, on_command_channel, NULL);
+    }
+
+    if (rc) {
+        disconnect();
+    }
+
+    return rc;
+}
+
+/** Reconnection timer handler, see loop_timer_cb for details. */
+static int on_reconnect(void* data)
+{
+    (void)data;
+
+    if (connect_channels() == 0) {
+        fprintf(stderr, "IPC connection restored\n");
+        ++stats.reconnects;
+    } else {
+        reconnect_delay *= 2;
+        if (reconnect_delay > RECONNECT_DELAY_MAX) {
+            reconnect_delay = RECONNECT_DELAY_MAX;
+        }
+        loop_timer_set(reconnect_timer, reconnect_delay);
+    }
+
+    return 0;
+}
+
+/**
+ * Set event handlers and the mask of handled events.
+ * @param[in] fn_focus event handler for focus change, can be NULL
+ * @param[in] fn_title event handler for title change, can be NULL
+ * @param[in] fn_close event handler for window close, can be NULL
+ * @param[in] fn_workspace event handler for workspace focus, can be NULL
+ * @param[in] fn_layout event handler for layout change
+ * @param[in] fn_sync handler for state synchronization
+ */
+static void set_handlers(on_focus fn_focus, on_title fn_title,
+                         on_close fn_close, on_workspace fn_workspace,
+                         on_layout fn_layout, on_sync fn_sync)
+{
+    handle_focus = fn_focus;
+    handle_title = fn_title;
+    handle_close = fn_close;
+    handle_workspace = fn_workspace;
+    handle_layout = fn_layout;
+    handle_sync = fn_sync;
+
+    // input events are always handled to track keyboards and layouts
+    events_mask = EVENT_MASK(EVENT_LAYOUT) | EVENT_MASK(EVENT_KEYMAP) |
+        EVENT_MASK(EVENT_ADDED) | EVENT_MASK(EVENT_REMOVED);
+    if (fn_focus) {
+        events_mask |= EVENT_MASK(EVENT_FOCUS);
+    }
+    if (fn_title) {
+        events_mask |= EVENT_MASK(EVENT_TITLE);
+    }
+    if (fn_close) {
+        events_mask |= EVENT_MASK(EVENT_CLOSE);
+    }
+    if (fn_workspace) {
+        events_mask |= EVENT_MASK(EVENT_WORKSPACE);
+    }
+}
+
+void sway_stats(struct sway_stats* st)
+{
+    *st = stats;
+}
+
+int sway_monitor(on_focus fn_focus, on_title fn_title, on_close fn_close,
+                 on_workspace fn_workspace, on_layout fn_layout,
+                 on_sync fn_sync)
+{
+    set_handlers(fn_focus, fn_title, fn_close, fn_workspace, fn_layout,
+                 fn_sync);
+
+    if (!buf_reserve(&ipc_buf, IPC_BUF_SIZE)) {
+        return ENOMEM;
+    }
+
+    reconnect_timer = loop_timer(on_reconnect, NULL);
+    if (reconnect_timer < 0) {
+        return -reconnect_timer;
+    }
+
+    return connect_channels();
+}
+
+int sway_switch_layout(int layout)
+{
+    return cmd_sock >= 0 ? cmd_switch_layout(layout) : ENOTCONN;
+}
+
+bool sway_layout_available(int layout)
+{
+    const struct keyboard* kbd;
+    const size_t kbd_num = get_keyboards(&kbd);
+
+    if (layout < 0) {
+        return false;
+    }
+    if (kbd_num == 0) {
+        return true; // keyboards are unknown, the command targets all of them
+    }
+    for (size_t i = 0; i < kbd_num; ++i) {
+        if (kbd_has_layout(&kbd[i], layout)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int sway_replay(const char* path, on_focus fn_focus, on_title fn_title,
+                on_close fn_close, on_workspace fn_workspace,
+                on_layout fn_layout, on_sync fn_sync)
+{
+    struct record_reader reader;
+    struct record_frame frame;
+    const char* payload;
+    size_t events = 0, requests = 0, commands = 0;
+    int layout = -1;
+    int rc = 0;
+
+    set_handlers(fn_focus, fn_title, fn_close, fn_workspace, fn_layout,
+                 fn_sync);
+
+    if (!record_map(&reader, path)) {
+        return EIO;
+    }
+
+    const uint64_t start = metrics_now();
+    uint64_t last_ts = 0;
+    while (rc == 0 && record_next(&reader, &frame, &payload)) {
+        if (frame.timestamp - last_ts > REPLAY_BURST_GAP) {
+            check_divergence(); // end of the previous burst
+        }
+        last_ts = frame.timestamp;
+        if (frame.type & RECORD_SENT_BIT) {
+            ++commands;
+            continue;
+        }
+        // parsers modify the message, so make a null-terminated copy
+        if (!buf_reserve(&ipc_buf, frame.len + 1)) {
+            rc = ENOMEM;
+            break;
+        }
+        memcpy(ipc_buf.data, payload, frame.len);
+        ipc_buf.data[frame.len] = 0;
+
+        if (frame.type & IPC_EVENT_BIT) {
+            struct event ev;
+            ++events;
+            if (event_parse(ipc_buf.data, frame.type & ~IPC_EVENT_BIT,
+                            events_mask, &ev)) {
+                const int req = dispatch_event(&ev);
+                if (req >= 0) {
+                    // commands are not sent, but their results are recorded
+                    expect_layout(req);
+                    ++requests;
+                }
+            }
+        } else if (frame.type == IPC_GET_INPUTS) {
+            rc = load_keyboards(ipc_buf.data, &layout);
+        } else if (frame.type == IPC_GET_TREE) {
+            rc = load_tree(ipc_buf.data, layout);
+        }
+    }
+    check_divergence();
+    const uint64_t elapsed = metrics_now() - start;
+
+    record_unmap(&reader);
+
+    printf("events: %zu in %.3f ms (%.0f events/s)\n", events,
+           (double)elapsed / 1000000,
+           elapsed ? (double)events * 1000000000 / elapsed : 0.0);
+    printf("switches: %zu requested, %zu recorded\n", requests, commands);
+
     return rc;
 }
@@ -3,10 +3,14 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * Callback function: Window focus change handler.
  * @param[in] wnd_id identifier of currently focused window (container)
- * @param[in] app_id application id
+ * @param[in] app_id application id (X11 class for XWayland windows)
  * @param[in] title title of the window
  * @return keyboard layout to set, -1 to leave the current one
  */
@@ -15,7 +19,7 @@ typedef int (*on_focus)(int wnd_id, const char* app_id, const char* title);
 /**
  * Callback function: Window title change handler.
  * @param[in] wnd_id identifier of currently focused window (container)
- * @param[in] app_id application id
+ * @param[in] app_id application id (X11 class for XWayland windows)
  * @param[in] title title of the window
  * @return keyboard layout to set, -1 to leave the current one
  */
@@ -28,20 +32,110 @@ typedef int (*on_title)(int wnd_id, const char* app_id, const char* title);
  */
 typedef int (*on_close)(int wnd_id);
 
+/**
+ * Callback function: Workspace focus change handler.
+ * @param[in] workspace name of currently focused workspace
+ * @param[in] output name of the output of the workspace
+ * @return keyboard layout to set, -1 to leave the current one
+ */
+typedef int (*on_workspace)(const char* workspace, const char* output);
+
 /**
  * Callback function: Keyboard layout change handler.
+ * Called for changes made by the user. Changes caused by layout switch
+ * commands are reported only if no more commands are in flight, i.e. the
+ * handler is not called with intermediate layouts.
  * @param[in] layout current keyboard layout index
  */
 typedef void (*on_layout)(int layout);
 
+/** Window description. */
+struct sway_window {
+    int id;             ///< container id
+    const char* app_id; ///< application id or X11 class, NULL if not present
+    const char* title;  ///< window title, NULL if not present
+    bool focused;       ///< focus flag
+};
+
+/**
+ * Callback function: State synchronization handler.
+ * Called on every (re)connection before any event is received.
+ * @param[in] windows array of existing windows
+ * @param[in] num number of windows in the array
+ * @param[in] workspace name of the focused workspace, NULL if unknown
+ * @param[in] output name of the output of the focused workspace, NULL if
+ *                   unknown
+ * @param[in] layout currently active keyboard layout index, -1 if unknown
+ */
+typedef void (*on_sync)(const struct sway_window* windows, size_t num,
+                        const char* workspace, const char* output,
+                        int layout);
+
+/**
+ * Connect to Sway IPC and start event monitoring in the main loop.
+ * All events already buffered by the socket are handled as a batch, only
+ * the last layout requested by the handlers is set at the end of the batch.
+ * If the connection is lost, the daemon reconnects with growing delay and
+ * resynchronizes its state via the sync handler.
+ * Event handlers can be NULL: events without handlers are not subscribed.
+ * @param[in] fn_focus event handler for focus change
+ * @param[in] fn_title event handler for title change
+ * @param[in] fn_close event handler for window close
+ * @param[in] fn_workspace event handler for workspace focus change
+ * @param[in] fn_layout event handler for layout change
+ * @param[in] fn_sync handler for state synchronization
+ * @return error code of the initial connection
+ */
+int sway_monitor(on_focus fn_focus, on_title fn_title, on_close fn_close,
+                 on_workspace fn_workspace, on_layout fn_layout,
+                 on_sync fn_sync);
+
 /**
- * Connect to Sway IPC and start event monitoring.
- * Function never returns unless errors occurred.
+ * Set keyboard layout.
+ * @param[in] layout keyboard layout index to set
+ * @return error code, 0 on success
+ */
+int sway_switch_layout(int layout);
+
+/**
+ * Check if at least one keyboard can be switched to the layout.
+ * @param[in] layout keyboard layout index
+ * @return true if the switch command for the layout is not empty
+ */
+bool sway_layout_available(int layout);
+
+/**
+ * Replay IPC messages from the record file without connecting to Sway.
+ * Recorded events are passed to the handlers as fast as possible, events
+ * without handlers are skipped, see sway_monitor.
+ * @param[in] path path to the record file
  * @param[in] fn_focus event handler for focus change
  * @param[in] fn_title event handler for title change
  * @param[in] fn_close event handler for window close
+ * @param[in] fn_workspace event handler for workspace focus change
  * @param[in] fn_layout event handler for layout change
+ * @param[in] fn_sync handler for state synchronization
  * @return error code
  */
-int sway_monitor(on_focus fn_focus, on_title fn_title,
-                 on_close fn_close, on_layout fn_layout);
+int sway_replay(const char* path, on_focus fn_focus, on_title fn_title,
+                on_close fn_close, on_workspace fn_workspace,
+                on_layout fn_layout, on_sync fn_sync);
+
+/** IPC statistics. */
+struct sway_stats {
+    size_t commands;        ///< number of layout switch commands sent
+    size_t failures;        ///< number of failed commands
+    size_t reconnects;      ///< number of restored connections
+    size_t divergences;     ///< number of times keyboard layouts diverged
+    size_t own_events;      ///< layout changes caused by own commands
+    size_t collapsed;       ///< commands replaced by newer ones before sending
+    uint64_t latency_last;  ///< latency of the last command, microseconds
+    uint64_t latency_max;   ///< max command latency, microseconds
+    uint64_t latency_total; ///< total latency of all replied commands
+};
+
+/**
+ * Get IPC statistics.
+ * @param[out] st statistics
+ */
+void sway_stats(struct sway_stats* st);
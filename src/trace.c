@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#include "trace.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of records in the ring buffer (power of 2)
+#define TRACE_SIZE 4096
+// Max length of the dump file path
+#define TRACE_PATH_MAX 4096
+
+// Dump file signature and format version
+#define TRACE_MAGIC   "swkbdtrc"
+#define TRACE_VERSION 1
+
+/** Trace record. */
+struct trace_record {
+    uint64_t timestamp; ///< monotonic time, nanoseconds
+    uint64_t value;     ///< tab id or generic value
+    uint32_t window;    ///< window id
+    int16_t layout;     ///< keyboard layout index
+    uint16_t type;      ///< record type
+};
+
+/** Dump file header, followed by records from the oldest to the newest. */
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;   ///< number of records
+    int64_t realtime; ///< offset of the real time from the monotonic one, ns
+};
+
+// Fields used by the record types
+#define FIELD_WINDOW (1 << 0)
+#define FIELD_TAB    (1 << 1)
+#define FIELD_LAYOUT (1 << 2)
+#define FIELD_VALUE  (1 << 3)
+
+/** Record type description. */
+struct trace_format {
+    const char* name;
+    int fields;
+};
+
+static const struct trace_format formats[TRACE_TYPES] = {
+    [TRACE_FOCUS] = { "focus", FIELD_WINDOW | FIELD_TAB },
+    [TRACE_TITLE] = { "title", FIELD_WINDOW },
+    [TRACE_CLOSE] = { "close", FIELD_WINDOW },
+    [TRACE_STORE] = { "store", FIELD_WINDOW | FIELD_TAB | FIELD_LAYOUT },
+    [TRACE_FOUND] = { "found", FIELD_WINDOW | FIELD_TAB | FIELD_LAYOUT },
+    [TRACE_RULE] = { "rule", FIELD_WINDOW | FIELD_LAYOUT },
+    [TRACE_SET] = { "set", FIELD_WINDOW | FIELD_TAB | FIELD_LAYOUT },
+    [TRACE_LAYOUT] = { "layout", FIELD_WINDOW | FIELD_TAB | FIELD_LAYOUT },
+    [TRACE_OWN] = { "own", FIELD_LAYOUT },
+    [TRACE_COMMAND] = { "command", FIELD_LAYOUT },
+    [TRACE_SYNC] = { "sync", FIELD_WINDOW | FIELD_TAB | FIELD_LAYOUT },
+    [TRACE_ALLOCS] = { "allocs", FIELD_VALUE },
+    [TRACE_SIGNAL] = { "signal", FIELD_VALUE },
+    [TRACE_CONFIG] = { "config", FIELD_VALUE },
+};
+
+// Ring buffer of records and total number of added records
+static struct trace_record ring[TRACE_SIZE];
+static size_t ring_pos;
+
+static char dump_path[TRACE_PATH_MAX];
+static bool echo;
+
+/**
+ * Get offset of the real time from the monotonic one.
+ * @return offset in nanoseconds
+ */
+static int64_t realtime_offset(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec -
+        (int64_t)metrics_now();
+}
+
+/**
+ * Print trace record.
+ * @param[in] rec trace record
+ * @param[in] realtime offset of the real time from the monotonic one
+ */
+static void print_record(const struct trace_record* rec, int64_t realtime)
+{
+    const int64_t ns = (int64_t)rec->timestamp + realtime;
+    const time_t sec = ns / 1000000000;
+    struct tm tm;
+    char ts[16];
+
+    localtime_r(&sec, &tm);
+    strftime(ts, sizeof(ts), "%H:%M:%S", &tm);
+    printf("%s.%06" PRIi64, ts, (ns % 1000000000) / 1000);
+
+    if (rec->type >= TRACE_TYPES) {
+        printf(" unknown(%u)\n", rec->type);
+        return;
+    }
+    const struct trace_format* fmt = &formats[rec->type];
+    printf(" %-7s", fmt->name);
+    if (fmt->fields & FIELD_WINDOW) {
+        printf(" window=%x", rec->window);
+    }
+    if (fmt->fields & FIELD_TAB) {
+        printf(" tab=%" PRIx64, rec->value);
+    }
+    if (fmt->fields & FIELD_LAYOUT) {
+        printf(" layout=%d", rec->layout);
+    }
+    if (fmt->fields & FIELD_VALUE) {
+        printf(" value=%" PRIu64, rec->value);
+    }
+    printf("\n");
+}
+
+/**
+ * Write data to the file, async-signal-safe.
+ * @param[in] fd file descriptor
+ * @param[in] data data to write
+ * @param[in] len size of the data in bytes
+ * @return false on errors
+ */
+static bool write_all(int fd, const void* data, size_t len)
+{
+    while (len) {
+        const ssize_t rc = write(fd, data, len);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        len -= rc;
+        data = (const uint8_t*)data + rc;
+    }
+    return true;
+}
+
+/** Fatal signal handler: dump the trace and terminate. */
+static void on_fatal(int signum)
+{
+    trace_dump();
+    raise(signum); // default action is restored by SA_RESETHAND
+}
+
+bool trace_init(const char* path)
+{
+    const int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction sa;
+
+    if (!path) {
+        return true; // dump is disabled
+    }
+    if (strlen(path) >= sizeof(dump_path)) {
+        fprintf(stderr, "Trace file path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(dump_path, path);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_fatal;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+        sigaction(signals[i], &sa, NULL);
+    }
+
+    return true;
+}
+
+void trace_echo(bool enable)
+{
+    echo = enable;
+}
+
+void trace_put(enum trace_type type, uint32_t window, uint64_t value,
+               int layout)
+{
+    struct trace_record* rec = &ring[ring_pos++ & (TRACE_SIZE - 1)];
+    rec->timestamp = metrics_now();
+    rec->value = value;
+    rec->window = window;
+    rec->layout = layout;
+    rec->type = type;
+
+    if (echo) {
+        print_record(rec, realtime_offset());
+    }
+}
+
+bool trace_dump(void)
+{
+    struct trace_header hdr;
+    bool rc;
+
+    if (!*dump_path) {
+        return false;
+    }
+    // don't follow links planted in place of the dump file
+    const int fd = open(dump_path,
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                        0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    const size_t count = ring_pos < TRACE_SIZE ? ring_pos : TRACE_SIZE;
+    const size_t start = (ring_pos - count) & (TRACE_SIZE - 1);
+    const size_t first = count < TRACE_SIZE - start ? count : TRACE_SIZE - start;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.count = count;
+    hdr.realtime = realtime_offset();
+
+    rc = write_all(fd, &hdr, sizeof(hdr)) &&
+        write_all(fd, &ring[start], first * sizeof(ring[0])) &&
+        write_all(fd, ring, (count - first) * sizeof(ring[0]));
+
+    close(fd);
+    return rc;
+}
+
+int trace_decode(const char* path)
+{
+    struct trace_header hdr;
+    struct trace_record rec;
+    int rc = 0;
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        rc = errno;
+        fprintf(stderr, "Unable to open trace file %s: [%i] %s\n", path, rc,
+                strerror(rc));
+        return rc;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != TRACE_VERSION) {
+        fprintf(stderr, "Invalid trace file %s\n", path);
+        rc = EINVAL;
+    }
+    for (uint32_t i = 0; rc == 0 && i < hdr.count; ++i) {
+        if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+            fprintf(stderr, "Trace file %s is truncated\n", path);
+            rc = EIO;
+        } else {
+            print_record(&rec, hdr.realtime);
+        }
+    }
+
+    fclose(fp);
+    return rc;
+}
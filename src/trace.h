@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Types of trace records (decisions made by the daemon). */
+enum trace_type {
+    TRACE_FOCUS,   ///< Window focused: window, tab
+    TRACE_TITLE,   ///< Title of the focused window changed: window
+    TRACE_CLOSE,   ///< Window closed: window
+    TRACE_STORE,   ///< Layout of the previous window stored: window, tab, layout
+    TRACE_FOUND,   ///< Stored layout lookup: window, tab, layout
+    TRACE_RULE,    ///< Rules evaluated: window, layout
+    TRACE_SET,     ///< Layout requested: window, tab, layout (-1 if none)
+    TRACE_LAYOUT,  ///< Layout changed by user: window, tab, layout
+    TRACE_OWN,     ///< Layout changed by own command: layout
+    TRACE_COMMAND, ///< Switch command sent: layout
+    TRACE_SYNC,    ///< State synchronized: window, tab, layout
+    TRACE_ALLOCS,  ///< Number of heap allocations changed: value
+    TRACE_SIGNAL,  ///< Signal received: value
+    TRACE_CONFIG,  ///< Config reloaded: value (number of reloads)
+    TRACE_TYPES
+};
+
+/**
+ * Initialize trace: set dump file and install handlers of fatal signals.
+ * Records are collected in the fixed-size ring buffer, the buffer is dumped
+ * to the file by trace_dump and on crash.
+ * @param[in] path path to the dump file, NULL to disable dumps
+ * @return false if the path is too long
+ */
+bool trace_init(const char* path);
+
+/**
+ * Enable printing records to stdout as they are added (verbose mode).
+ * @param[in] enable true to enable printing
+ */
+void trace_echo(bool enable);
+
+/**
+ * Add record to the trace.
+ * @param[in] type record type
+ * @param[in] window window id
+ * @param[in] value tab id or generic value, see trace_type
+ * @param[in] layout keyboard layout index or generic value
+ */
+void trace_put(enum trace_type type, uint32_t window, uint64_t value,
+               int layout);
+
+/**
+ * Write trace records to the dump file, async-signal-safe.
+ * @return false on errors
+ */
+bool trace_dump(void);
+
+/**
+ * Print trace records from the dump file to stdout.
+ * @param[in] path path to the dump file
+ * @return error code, 0 on success
+ */
+int trace_decode(const char* path);
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+// Benchmark of the IPC event scanner against the former json-c parsing:
+// json_tokener_parse of the whole message plus lookups of the used fields.
+// Usage: event_bench [ITERATIONS], default is 200000.
+
+#include "event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json.h>
+
+// Default number of iterations per message
+#define ITERATIONS 200000
+
+// IPC event types (without the event bit)
+#define SOURCE_WINDOW 0x03
+#define SOURCE_INPUT  0x15
+
+// Event types handled by the daemon in the default window mode
+#define MASK_WINDOW                                                         \
+    (EVENT_MASK(EVENT_FOCUS) | EVENT_MASK(EVENT_TITLE) |                    \
+     EVENT_MASK(EVENT_CLOSE) | EVENT_MASK(EVENT_LAYOUT) |                   \
+     EVENT_MASK(EVENT_KEYMAP) | EVENT_MASK(EVENT_ADDED) |                   \
+     EVENT_MASK(EVENT_REMOVED))
+
+// Container of the window event as Sway sends it
+#define CONTAINER                                                           \
+    "{ \"id\": 42, \"type\": \"con\", \"orientation\": \"none\", "          \
+    "\"percent\": 0.5, \"urgent\": false, \"marks\": [ \"web\" ], "         \
+    "\"focused\": true, \"layout\": \"none\", \"border\": \"pixel\", "      \
+    "\"current_border_width\": 2, \"rect\": { \"x\": 0, \"y\": 0, "         \
+    "\"width\": 1920, \"height\": 1080 }, \"deco_rect\": { \"x\": 0, "      \
+    "\"y\": 0, \"width\": 0, \"height\": 0 }, \"window_rect\": { "          \
+    "\"x\": 2, \"y\": 2, \"width\": 1916, \"height\": 1076 }, "             \
+    "\"geometry\": { \"x\": 0, \"y\": 0, \"width\": 1916, "                 \
+    "\"height\": 1076 }, \"name\": \"Mozilla Firefox \\u2014 Page "         \
+    "with a \\\"quoted\\\" title\", \"window\": null, \"nodes\": [ ], "     \
+    "\"floating_nodes\": [ ], \"focus\": [ ], \"fullscreen_mode\": 0, "     \
+    "\"sticky\": false, \"pid\": 1234, \"app_id\": \"firefox\", "           \
+    "\"visible\": true, \"max_render_time\": 0, \"shell\": "                \
+    "\"xdg_shell\", \"inhibit_idle\": false, \"idle_inhibitors\": { "       \
+    "\"user\": \"none\", \"application\": \"none\" } }"
+
+/** Benchmark message. */
+struct message {
+    const char* name;
+    uint32_t source;
+    const char* json;
+};
+
+static const struct message messages[] = {
+    { "focus", SOURCE_WINDOW,
+      "{ \"change\": \"focus\", \"container\": " CONTAINER " }" },
+    { "xkb_layout", SOURCE_INPUT,
+      "{ \"change\": \"xkb_layout\", \"input\": { \"identifier\": "
+      "\"1:1:AT_Translated_Set_2_keyboard\", \"name\": \"AT Translated Set "
+      "2 keyboard\", \"vendor\": 1, \"product\": 1, \"type\": \"keyboard\", "
+      "\"xkb_layout_names\": [ \"English (US)\", \"Russian\" ], "
+      "\"xkb_active_layout_index\": 1, \"xkb_active_layout_name\": "
+      "\"Russian\", \"libinput\": { \"send_events\": \"enabled\" } } }" },
+    { "move", SOURCE_WINDOW,
+      "{ \"change\": \"move\", \"container\": " CONTAINER " }" },
+};
+
+/** Get monotonic time in nanoseconds. */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Reference: the former json-c parsing, returns a checksum. */
+static uint64_t parse_json_c(const char* msg)
+{
+    struct json_object* root = json_tokener_parse(msg);
+    struct json_object* node;
+    struct json_object* sub;
+    uint64_t sum = 0;
+
+    if (!root) {
+        return 0;
+    }
+    if (json_object_object_get_ex(root, "change", &node)) {
+        const char* change = json_object_get_string(node);
+        if (strcmp(change, "focus") == 0 || strcmp(change, "title") == 0 ||
+            strcmp(change, "close") == 0) {
+            if (json_object_object_get_ex(root, "container", &node)) {
+                if (json_object_object_get_ex(node, "id", &sub)) {
+                    sum += json_object_get_int(sub);
+                }
+                if (json_object_object_get_ex(node, "app_id", &sub)) {
+                    sum += strlen(json_object_get_string(sub));
+                }
+                if (json_object_object_get_ex(node, "name", &sub)) {
+                    sum += strlen(json_object_get_string(sub));
+                }
+            }
+        } else if (strcmp(change, "xkb_layout") == 0) {
+            if (json_object_object_get_ex(root, "input", &node) &&
+                json_object_object_get_ex(node, "xkb_active_layout_index",
+                                          &sub)) {
+                sum += json_object_get_int(sub);
+            }
+        }
+    }
+    json_object_put(root);
+
+    return sum;
+}
+
+/** Event scanner, returns a checksum. */
+static uint64_t parse_event(char* msg, uint32_t source)
+{
+    struct event ev;
+    uint64_t sum = 0;
+
+    if (event_parse(msg, source, MASK_WINDOW, &ev)) {
+        sum += ev.type + ev.wnd_id + ev.layout;
+        sum += ev.app_id ? strlen(ev.app_id) : 0;
+        sum += ev.title ? strlen(ev.title) : 0;
+    }
+
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    const long iterations = argc > 1 ? strtol(argv[1], NULL, 0) : ITERATIONS;
+    volatile uint64_t sink = 0;
+
+    if (iterations <= 0) {
+        fprintf(stderr, "Invalid number of iterations: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    printf("parse cost per event, %ld iterations\n", iterations);
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); ++i) {
+        const struct message* msg = &messages[i];
+        const size_t size = strlen(msg->json) + 1;
+        char* buf = malloc(size);
+        if (!buf) {
+            fprintf(stderr, "Not enough memory\n");
+            return EXIT_FAILURE;
+        }
+
+        // both parsers get a fresh copy: the scanner modifies it in place
+        const double t0 = now();
+        for (long n = 0; n < iterations; ++n) {
+            memcpy(buf, msg->json, size);
+            sink += parse_json_c(buf);
+        }
+        const double t1 = now();
+        for (long n = 0; n < iterations; ++n) {
+            memcpy(buf, msg->json, size);
+            sink += parse_event(buf, msg->source);
+        }
+        const double t2 = now();
+
+        printf("%-10s %4zu bytes: json-c %7.0f ns, event_parse %6.0f ns\n",
+               msg->name, size - 1, (t1 - t0) / iterations,
+               (t2 - t1) / iterations);
+        free(buf);
+    }
+
+    return EXIT_SUCCESS;
+}
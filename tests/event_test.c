@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+// Test of the IPC event scanner: extracted fields, unescaping, skipping of
+// nested values, malformed input and the early exit on masked events.
+// Usage: event_test
+
+#include "event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// IPC event types (without the event bit)
+#define SOURCE_WORKSPACE 0x00
+#define SOURCE_WINDOW    0x03
+#define SOURCE_INPUT     0x15
+
+// All handled event types
+#define MASK_ALL ((EVENT_MASK(EVENT_TYPES) - 1) & ~EVENT_MASK(EVENT_NONE))
+
+/** Test case: source message and the expected result. */
+struct test_case {
+    const char* name;
+    uint32_t source;
+    uint32_t mask;
+    const char* msg;
+    bool rc;          ///< expected return value
+    struct event ev;  ///< expected fields, checked only if rc is true
+};
+
+// Expected fields of the event without any data
+#define NO_FIELDS .wnd_id = -1, .layout = -1, .layouts_num = -1
+
+static const struct test_case cases[] = {
+    {
+        "focus", SOURCE_WINDOW, MASK_ALL,
+        "{ \"change\": \"focus\", \"container\": { \"id\": 10, "
+        "\"type\": \"con\", \"app_id\": \"foot\", \"name\": \"Shell\", "
+        "\"nodes\": [] } }",
+        true, { EVENT_FOCUS, 10, "foot", "Shell", NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "escaped quotes and backslashes", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"id\":1,"
+        "\"app_id\":\"a\\/b\",\"name\":\"say \\\"hi\\\" C:\\\\dir\\\\\"}}",
+        true, { EVENT_TITLE, 1, "a/b", "say \"hi\" C:\\dir\\", NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "control escapes", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"id\":1,"
+        "\"name\":\"a\\tb\\nc\\rd\\be\\ff\"}}",
+        true, { EVENT_TITLE, 1, NULL, "a\tb\nc\rd\be\ff", NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "unicode escapes", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"id\":1,"
+        "\"name\":\"\\u0041\\u00e9\\u4E2D \\ud83d\\ude00!\"}}",
+        true, { EVENT_TITLE, 1, NULL, "A\xc3\xa9\xe4\xb8\xad \xf0\x9f\x98\x80!",
+                NULL, -1, -1, NULL, NULL, NULL, NULL },
+    },
+    {
+        "unpaired surrogate", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"id\":1,"
+        "\"name\":\"\\ud83d x\"}}",
+        false, { NO_FIELDS },
+    },
+    {
+        "invalid hex digits", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"id\":1,\"name\":\"\\u00g0\"}}",
+        false, { NO_FIELDS },
+    },
+    {
+        "container before change, nested nodes", SOURCE_WINDOW, MASK_ALL,
+        "{\"container\":{\"nodes\":[{\"id\":99,\"name\":\"inner\","
+        "\"app_id\":\"in\",\"nodes\":[{\"id\":98,\"name\":\"deep\"}]}],"
+        "\"name\":\"Outer\",\"floating_nodes\":[{\"id\":97,\"name\":\"f\"}],"
+        "\"rect\":{\"x\":0,\"y\":0},\"marks\":[\"id\",\"name\"],"
+        "\"id\":7,\"app_id\":\"x\"},\"change\":\"title\"}",
+        true, { EVENT_TITLE, 7, "x", "Outer", NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "braces and quotes inside strings", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\",\"container\":{\"marks\":[\"}]\\\"{\"],"
+        "\"id\":5,\"name\":\"{[\\\\\"}}",
+        true, { EVENT_FOCUS, 5, NULL, "{[\\", NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "null values", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\",\"container\":{\"id\":3,\"app_id\":null,"
+        "\"name\":null,\"window_properties\":{\"class\":\"Firefox\","
+        "\"instance\":null},\"shell\":\"xwayland\"}}",
+        true, { EVENT_FOCUS, 3, NULL, NULL, "Firefox", -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "null container", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\",\"container\":null}",
+        false, { NO_FIELDS },
+    },
+    {
+        "xkb_layout", SOURCE_INPUT, MASK_ALL,
+        "{\"change\":\"xkb_layout\",\"input\":{\"identifier\":\"1:1:Kbd\","
+        "\"name\":\"Kbd\",\"type\":\"keyboard\",\"xkb_layout_names\":"
+        "[\"English (US)\", \"Russian\" ,\"German\"],"
+        "\"xkb_active_layout_index\":2,\"libinput\":{\"send_events\":null}}}",
+        true, { EVENT_LAYOUT, -1, NULL, NULL, NULL, 2, 3,
+                "1:1:Kbd", "keyboard", NULL, NULL },
+    },
+    {
+        "input without layouts", SOURCE_INPUT, MASK_ALL,
+        "{\"change\":\"added\",\"input\":{\"identifier\":\"2:2:Mouse\","
+        "\"type\":\"pointer\",\"xkb_layout_names\":[],"
+        "\"xkb_active_layout_index\":null}}",
+        true, { EVENT_ADDED, -1, NULL, NULL, NULL, -1, 0,
+                "2:2:Mouse", "pointer", NULL, NULL },
+    },
+    {
+        "workspace", SOURCE_WORKSPACE, MASK_ALL,
+        "{\"change\":\"focus\",\"old\":{\"name\":\"2\",\"output\":\"HDMI-1\"},"
+        "\"current\":{\"nodes\":[{\"name\":\"x\",\"output\":\"y\"}],"
+        "\"name\":\"1\",\"output\":\"eDP-1\"}}",
+        true, { EVENT_WORKSPACE, -1, NULL, NULL, NULL, -1, -1,
+                NULL, NULL, "1", "eDP-1" },
+    },
+    {
+        "workspace without current", SOURCE_WORKSPACE, MASK_ALL,
+        "{\"change\":\"focus\",\"current\":null,\"old\":null}",
+        true, { EVENT_WORKSPACE, -1, NULL, NULL, NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "change of another source", SOURCE_INPUT, MASK_ALL,
+        "{\"change\":\"focus\",\"input\":{\"xkb_active_layout_index\":1}}",
+        true, { EVENT_NONE, NO_FIELDS },
+    },
+    {
+        "masked: rest is not parsed", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"move\",\"container\":{\"id\":1,\"name\":\"unterm",
+        true, { EVENT_NONE, NO_FIELDS },
+    },
+    {
+        "masked: handled type is disabled", SOURCE_WINDOW,
+        EVENT_MASK(EVENT_CLOSE),
+        "{\"change\":\"focus\",\"container\":{\"id\":1,\"name\":\"x\"}}",
+        true, { EVENT_NONE, NO_FIELDS },
+    },
+    {
+        "masked: fields before change", SOURCE_WINDOW,
+        EVENT_MASK(EVENT_FOCUS),
+        "{\"container\":{\"id\":4},\"change\":\"title\",[broken",
+        true, { EVENT_NONE, 4, NULL, NULL, NULL, -1, -1,
+                NULL, NULL, NULL, NULL },
+    },
+    {
+        "truncated string", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\",\"container\":{\"id\":10,\"name\":\"abc",
+        false, { NO_FIELDS },
+    },
+    {
+        "truncated object", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\",\"container\":{\"id\":10,\"nodes\":[{",
+        false, { NO_FIELDS },
+    },
+    {
+        "truncated after value", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"focus\"",
+        false, { NO_FIELDS },
+    },
+    {
+        "truncated escape", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\":\"title\",\"container\":{\"name\":\"\\u00",
+        false, { NO_FIELDS },
+    },
+    {
+        "missing colon", SOURCE_WINDOW, MASK_ALL,
+        "{\"change\" \"focus\"}",
+        false, { NO_FIELDS },
+    },
+    { "empty message", SOURCE_WINDOW, MASK_ALL, "", false, { NO_FIELDS } },
+    { "array", SOURCE_WINDOW, MASK_ALL, "[{\"change\":\"focus\"}]", false,
+      { NO_FIELDS } },
+    { "null", SOURCE_WINDOW, MASK_ALL, "null", false, { NO_FIELDS } },
+    { "string", SOURCE_WINDOW, MASK_ALL, "\"focus\"", false, { NO_FIELDS } },
+    { "empty object", SOURCE_WINDOW, MASK_ALL, " { } ", true,
+      { EVENT_NONE, NO_FIELDS } },
+};
+
+/** Compare strings, any of them can be NULL. */
+static bool str_eq(const char* a, const char* b)
+{
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+/** Print field mismatch. */
+static void mismatch(const char* field, const char* expect, const char* got)
+{
+    printf("  %s: expected \"%s\", got \"%s\"\n", field,
+           expect ? expect : "(null)", got ? got : "(null)");
+}
+
+/**
+ * Run test case.
+ * @return number of mismatches
+ */
+static size_t run_case(const struct test_case* tc)
+{
+    const struct event* exp = &tc->ev;
+    struct event ev;
+    size_t errors = 0;
+
+    // the message is modified in place
+    char* msg = strdup(tc->msg);
+    if (!msg) {
+        return 1;
+    }
+
+    const bool rc = event_parse(msg, tc->source, tc->mask, &ev);
+    if (rc != tc->rc) {
+        printf("  result: expected %d, got %d\n", tc->rc, rc);
+        ++errors;
+    } else if (rc) {
+        if (ev.type != exp->type || ev.wnd_id != exp->wnd_id ||
+            ev.layout != exp->layout || ev.layouts_num != exp->layouts_num) {
+            printf("  type %d, id %d, layout %d/%d: expected %d, %d, %d/%d\n",
+                   ev.type, ev.wnd_id, ev.layout, ev.layouts_num, exp->type,
+                   exp->wnd_id, exp->layout, exp->layouts_num);
+            ++errors;
+        }
+#define CHECK_STR(field)                              \
+        if (!str_eq(ev.field, exp->field)) {          \
+            mismatch(#field, exp->field, ev.field);   \
+            ++errors;                                 \
+        }
+        CHECK_STR(app_id);
+        CHECK_STR(title);
+        CHECK_STR(wnd_class);
+        CHECK_STR(input_id);
+        CHECK_STR(input_type);
+        CHECK_STR(workspace);
+        CHECK_STR(output);
+#undef CHECK_STR
+    }
+
+    free(msg);
+    return errors;
+}
+
+/**
+ * Check command reply parser.
+ * @return number of mismatches
+ */
+static size_t test_reply(void)
+{
+    static const struct {
+        const char* msg;
+        bool rc;
+        const char* error;
+    } replies[] = {
+        { "[ { \"success\": true } ]", true, NULL },
+        { "[{\"success\":true},{\"success\":true}]", true, NULL },
+        { "[{\"success\":true},{\"success\":false,"
+          "\"error\":\"no \\\"kbd\\\"\"},{\"success\":false,\"error\":\"2\"}]",
+          false, "no \"kbd\"" },
+        { "[{\"success\":true}", false, NULL },
+        { "{\"success\":true}", false, NULL },
+    };
+    size_t errors = 0;
+
+    for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); ++i) {
+        const char* error;
+        char* msg = strdup(replies[i].msg);
+        if (!msg) {
+            return 1;
+        }
+        if (reply_parse(msg, &error) != replies[i].rc ||
+            !str_eq(error, replies[i].error)) {
+            printf("  reply %zu: %s\n", i, replies[i].msg);
+            ++errors;
+        }
+        free(msg);
+    }
+
+    return errors;
+}
+
+/**
+ * Check subscribe request builder.
+ * @return number of mismatches
+ */
+static size_t test_subscription(void)
+{
+    char buf[64];
+    size_t errors = 0;
+
+    errors += !event_subscription(MASK_ALL, buf, sizeof(buf)) ||
+        strcmp(buf, "[ \"window\", \"input\", \"workspace\" ]") != 0;
+    errors += !event_subscription(EVENT_MASK(EVENT_LAYOUT) |
+                                      EVENT_MASK(EVENT_KEYMAP),
+                                  buf, sizeof(buf)) ||
+        strcmp(buf, "[ \"input\" ]") != 0;
+    errors += !event_subscription(0, buf, sizeof(buf)) ||
+        strcmp(buf, "[ ]") != 0;
+    errors += event_subscription(MASK_ALL, buf, 16);
+
+    return errors;
+}
+
+/** Print and count the test result. */
+static size_t check(const char* name, size_t errors)
+{
+    printf("%s %s\n", errors == 0 ? "PASS" : "FAIL", name);
+    return errors != 0;
+}
+
+int main(void)
+{
+    size_t failed = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        failed += check(cases[i].name, run_case(&cases[i]));
+    }
+    failed += check("command reply", test_reply());
+    failed += check("subscription", test_subscription());
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
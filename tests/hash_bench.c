@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+// Benchmark of the title hash against the byte-at-a-time djb2.
+// Usage: hash_bench [FILE], where FILE contains one title per line, a
+// synthetic corpus of browser titles is used by default.
+
+#include "hash.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Number of titles in the synthetic corpus
+#define CORPUS_SIZE 20000
+// Number of passes over the corpus
+#define PASSES 200
+// Number of distinct titles to check for collisions
+#define UNIQUE_TITLES 2000000
+// Max length of the title
+#define TITLE_MAX 1024
+
+// Words of synthetic titles
+static const char* const words[] = {
+    "api", "article", "c++", "chromium", "comments", "discussion", "docs",
+    "error", "firefox", "fix", "free", "github", "google", "guide", "how",
+    "in", "issue", "linux", "list", "mailing", "mozilla", "music", "news",
+    "overflow", "pull", "python", "reddit", "reference", "request", "results",
+    "review", "rust", "search", "stack", "the", "to", "tutorial", "video",
+    "wikipedia", "youtube",
+};
+#define WORDS_NUM (sizeof(words) / sizeof(words[0]))
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/** Get pseudo random number (xorshift64). */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/** Reference: 32-bit djb2, the former title hash. */
+static uint32_t djb2(const char* str)
+{
+    uint32_t hash = 5381;
+    while (*str) {
+        hash = (hash << 5) + hash + (unsigned char)*str++;
+    }
+    return hash;
+}
+
+/** Get monotonic time in nanoseconds. */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Generate browser-like title: page name or URL with the browser suffix.
+ * @param[out] buf destination buffer, TITLE_MAX bytes
+ */
+static void gen_title(char* buf)
+{
+    const size_t num = 1 + rng() % 16;
+    const bool url = rng() % 4 == 0;
+    size_t len = 0;
+
+    if (url) {
+        len = snprintf(buf, TITLE_MAX, "https://example.com");
+    }
+    for (size_t i = 0; i < num && len < TITLE_MAX - 64; ++i) {
+        len += snprintf(buf + len, TITLE_MAX - len, "%s%s",
+                        url ? "/" : (i ? " " : ""), words[rng() % WORDS_NUM]);
+    }
+    snprintf(buf + len, TITLE_MAX - len, " — Mozilla Firefox");
+}
+
+/** Load titles from the file or generate synthetic corpus. */
+static size_t load_corpus(const char* path, char*** titles)
+{
+    char line[TITLE_MAX];
+    size_t num = 0, cap = CORPUS_SIZE;
+    char** list = malloc(cap * sizeof(*list));
+    FILE* fp = NULL;
+
+    if (path) {
+        fp = fopen(path, "r");
+        if (!fp) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (list) {
+        if (fp) {
+            if (!fgets(line, sizeof(line), fp)) {
+                break;
+            }
+            line[strcspn(line, "\n")] = 0;
+        } else if (num < CORPUS_SIZE) {
+            gen_title(line);
+        } else {
+            break;
+        }
+        if (num == cap) {
+            cap *= 2;
+            list = realloc(list, cap * sizeof(*list));
+        }
+        if (!list || !(list[num++] = strdup(line))) {
+            fprintf(stderr, "Not enough memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (fp) {
+        fclose(fp);
+    }
+
+    *titles = list;
+    return num;
+}
+
+/** qsort comparator of 32-bit hashes. */
+static int cmp32(const void* a, const void* b)
+{
+    const uint32_t va = *(const uint32_t*)a, vb = *(const uint32_t*)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/** qsort comparator of 64-bit hashes. */
+static int cmp64(const void* a, const void* b)
+{
+    const uint64_t va = *(const uint64_t*)a, vb = *(const uint64_t*)b;
+    return va < vb ? -1 : va > vb;
+}
+
+int main(int argc, char* argv[])
+{
+    char** titles;
+    const size_t num = load_corpus(argc > 1 ? argv[1] : NULL, &titles);
+    volatile uint64_t sink = 0;
+    size_t bytes = 0;
+
+    if (num == 0) {
+        fprintf(stderr, "Empty corpus\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        bytes += strlen(titles[i]);
+    }
+    printf("corpus: %zu titles, %.1f bytes on average\n", num,
+           (double)bytes / num);
+
+    // throughput
+    const double t0 = now();
+    for (size_t pass = 0; pass < PASSES; ++pass) {
+        for (size_t i = 0; i < num; ++i) {
+            sink += djb2(titles[i]);
+        }
+    }
+    const double t1 = now();
+    for (size_t pass = 0; pass < PASSES; ++pass) {
+        for (size_t i = 0; i < num; ++i) {
+            sink += str_hash(titles[i]);
+        }
+    }
+    const double t2 = now();
+    printf("djb2:     %.1f ns/title\n", (t1 - t0) / (PASSES * num));
+    printf("str_hash: %.1f ns/title\n", (t2 - t1) / (PASSES * num));
+
+    // collisions of distinct titles: corpus entries with unique suffixes
+    uint32_t* h32 = malloc(UNIQUE_TITLES * sizeof(*h32));
+    uint64_t* h64 = malloc(UNIQUE_TITLES * sizeof(*h64));
+    if (!h32 || !h64) {
+        fprintf(stderr, "Not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < UNIQUE_TITLES; ++i) {
+        char title[TITLE_MAX + 32];
+        snprintf(title, sizeof(title), "%s #%zu", titles[i % num], i);
+        h32[i] = djb2(title);
+        h64[i] = str_hash(title);
+    }
+    qsort(h32, UNIQUE_TITLES, sizeof(*h32), cmp32);
+    qsort(h64, UNIQUE_TITLES, sizeof(*h64), cmp64);
+    size_t coll32 = 0, coll64 = 0;
+    for (size_t i = 1; i < UNIQUE_TITLES; ++i) {
+        coll32 += h32[i] == h32[i - 1];
+        coll64 += h64[i] == h64[i - 1];
+    }
+    printf("collisions over %d distinct titles: djb2 %zu, str_hash %zu\n",
+           UNIQUE_TITLES, coll32, coll64);
+
+    free(h32);
+    free(h64);
+    for (size_t i = 0; i < num; ++i) {
+        free(titles[i]);
+    }
+    free(titles);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+"""
+Benchmarks of swaykbdd against the mock compositor.
+
+Usage: ipc_bench.py BINARY [--count N] [--rate EPS] [--replay FILE]
+"""
+
+import argparse
+import sys
+import time
+
+from sway_mock import SwayMock, Daemon
+
+
+def percentile(values, pct):
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * pct // 100)]
+
+
+def wait_processed(daemon, num, timeout=30.0):
+    """Wait until the daemon handles num events, return stats."""
+    deadline = time.monotonic() + timeout
+    while True:
+        stats = daemon.stats()
+        done = sum(value for name, value in stats.items()
+                   if name.startswith("swaykbdd_events_processed_total") or
+                   name.startswith("swaykbdd_events_coalesced_total"))
+        if done >= num or time.monotonic() > deadline:
+            return stats
+        time.sleep(0.05)
+
+
+def stage_averages(stats, event_type):
+    """Average duration of event path stages, microseconds."""
+    result = {}
+    for stage in ("read", "parse", "handle", "switch"):
+        labels = f'{{type="{event_type}",stage="{stage}"}}'
+        count = stats.get("swaykbdd_event_stage_seconds_count" + labels)
+        if count:
+            total = stats["swaykbdd_event_stage_seconds_sum" + labels]
+            result[stage] = total / count * 1e6
+    return result
+
+
+def report(name, values):
+    print(f"{name}:")
+    for key, value in values.items():
+        if isinstance(value, float):
+            value = f"{value:.2f}"
+        print(f"  {key}: {value}")
+
+
+def bench_pingpong(binary, args):
+    """Latency from the focus event to the received switch command."""
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    daemon = Daemon(binary, mock)
+    try:
+        mock.user_switch(1)
+        time.sleep(0.2)
+        latency = []
+        for i in range(args.count // 10):
+            start = time.monotonic_ns()
+            mock.focus(11 if i % 2 == 0 else 10)
+            if not mock.wait_commands(i + 1):
+                raise RuntimeError("switch command is not received")
+            latency.append((mock.commands[i][0] - start) / 1000)
+        stats = daemon.stats()
+        report("pingpong", {
+            "switches": len(latency),
+            "p50_us": percentile(latency, 50),
+            "p99_us": percentile(latency, 99),
+            **{f"{k}_us": v for k, v in stage_averages(stats,
+                                                       "focus").items()},
+        })
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def bench_focus_storm(binary, args):
+    """Burst of focus events over many browser windows with unique titles."""
+    mock = SwayMock()
+    daemon = Daemon(binary, mock)
+    try:
+        windows = max(1, args.count // 4)
+        start = time.monotonic()
+        for i in range(args.count):
+            wnd = 100 + i % windows
+            mock.focus(wnd, "firefox", f"Page {wnd}")
+            if args.rate:
+                time.sleep(1 / args.rate)
+        sent = time.monotonic() - start
+        stats = wait_processed(daemon, args.count)
+        report("focus_storm", {
+            "events": args.count,
+            "windows": windows,
+            "send_s": sent,
+            "handled_s": time.monotonic() - start,
+            "rss_kb": rss_kb(daemon),
+            **{f"{k}_us": v for k, v in stage_averages(stats,
+                                                       "focus").items()},
+        })
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def bench_title_churn(binary, args):
+    """Title changes of the focused browser window."""
+    mock = SwayMock()
+    mock.add_window(10, "firefox", "Page 0", focused=True)
+    daemon = Daemon(binary, mock)
+    try:
+        start = time.monotonic()
+        for i in range(args.count):
+            mock.title(10, "firefox", f"Page {i % 64}")
+            if args.rate:
+                time.sleep(1 / args.rate)
+        stats = wait_processed(daemon, args.count)
+        report("title_churn", {
+            "events": args.count,
+            "handled_s": time.monotonic() - start,
+            "switches": len(mock.commands),
+            **{f"{k}_us": v for k, v in stage_averages(stats,
+                                                       "title").items()},
+        })
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def bench_large_tree(binary, args):
+    """Startup with many windows in the tree."""
+    mock = SwayMock()
+    for i in range(args.count):
+        mock.add_window(100 + i, "foot", f"Terminal {i}",
+                        focused=i == args.count - 1)
+    start = time.monotonic()
+    daemon = Daemon(binary, mock)
+    try:
+        report("large_tree", {
+            "windows": args.count,
+            "startup_ms": (time.monotonic() - start) * 1000,
+        })
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def bench_replay(binary, args):
+    """Replay of the recorded event stream."""
+    mock = SwayMock()
+    daemon = Daemon(binary, mock)
+    try:
+        start = time.monotonic()
+        sent = mock.replay(args.replay, args.rate)
+        stats = wait_processed(daemon, sent)
+        report("replay", {
+            "events": sent,
+            "handled_s": time.monotonic() - start,
+            "switches": len(mock.commands),
+            **{f"{t}_{k}_us": v for t in ("focus", "title")
+               for k, v in stage_averages(stats, t).items()},
+        })
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def rss_kb(daemon):
+    with open(f"/proc/{daemon.proc.pid}/status", encoding="ascii") as file:
+        for line in file:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip())
+    parser.add_argument("binary", help="path to swaykbdd")
+    parser.add_argument("--count", type=int, default=4000,
+                        help="number of events per scenario")
+    parser.add_argument("--rate", type=int, default=0,
+                        help="events per second, 0 for max speed")
+    parser.add_argument("--replay", help="record file to replay")
+    args = parser.parse_args()
+
+    if args.replay:
+        bench_replay(args.binary, args)
+    else:
+        bench_pingpong(args.binary, args)
+        bench_focus_storm(args.binary, args)
+        bench_title_churn(args.binary, args)
+        bench_large_tree(args.binary, args)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
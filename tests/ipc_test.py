@@ -0,0 +1,236 @@
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+"""End-to-end tests of swaykbdd against the mock compositor."""
+
+import os
+import socket
+import subprocess
+import sys
+import time
+
+from sway_mock import SwayMock, Daemon, run_tests
+
+
+def settle(timeout=0.2):
+    time.sleep(timeout)
+
+
+def test_restore_window_layout(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    daemon = Daemon(binary, mock)
+    try:
+        mock.user_switch(1)  # window 10 gets layout 1
+        settle()
+        mock.focus(11)
+        assert mock.wait_commands(1), "no switch to the default layout"
+        mock.focus(10)
+        assert mock.wait_commands(2), "no switch to the stored layout"
+        assert [layout for _, layout in mock.commands] == [0, 1]
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_tab_layouts(binary):
+    mock = SwayMock()
+    mock.add_window(10, app_id="firefox", title="Mail", focused=True)
+    daemon = Daemon(binary, mock)
+    try:
+        mock.user_switch(1)  # tab "Mail" gets layout 1
+        settle()
+        mock.title(10, "firefox", "News")
+        assert mock.wait_commands(1)
+        mock.title(10, "firefox", "Mail")
+        assert mock.wait_commands(2)
+        assert [layout for _, layout in mock.commands] == [0, 1]
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_keyboards_only(binary):
+    mock = SwayMock(keyboards=2)
+    mock.add_window(10, focused=True)
+    daemon = Daemon(binary, mock)
+    try:
+        mock.user_switch(1)
+        settle()
+        mock.focus(11)
+        assert mock.wait_commands(1)
+        settle()
+        assert all(kbd.get("xkb_active_layout_index", 0) == 0
+                   for kbd in mock.keyboards)
+        stats = daemon.stats()
+        # each keyboard reports the switch, only one is handled
+        assert stats['swaykbdd_events_duplicate_total{type="xkb_layout"}'] > 0
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_control_socket(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    path = mock.dir + "/control.sock"
+    daemon = Daemon(binary, mock, "--control", path)
+    try:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.connect(path)
+            sock.sendall(b"set 10 1\nget\n")
+            reply = b""
+            while reply.count(b"\n") < 2:
+                reply += sock.recv(256)
+        lines = reply.decode().splitlines()
+        assert lines == ["ok", "ok 1"], lines
+        assert mock.wait_commands(1)
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def control(path, request, lines=1):
+    """Send control request, return reply lines."""
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        sock.sendall(request)
+        reply = b""
+        while reply.count(b"\n") < lines:
+            chunk = sock.recv(256)
+            if not chunk:
+                break
+            reply += chunk
+    return reply.decode().splitlines()
+
+
+def test_unavailable_layout(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    path = mock.dir + "/control.sock"
+    daemon = Daemon(binary, mock, "--default", "5", "--control", path)
+    try:
+        mock.user_switch(1)
+        settle()
+        mock.focus(11)  # no keyboard has the default layout
+        settle()
+        assert not mock.commands, mock.commands
+        lines = control(path, b"get\n")
+        assert lines == ["ok 1"], lines
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_control_set_invalid(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    path = mock.dir + "/control.sock"
+    daemon = Daemon(binary, mock, "--control", path)
+    try:
+        lines = control(path, b"set 10 7\nget\n", 2)
+        assert lines[0].startswith("error"), lines
+        assert lines[1] == "ok 0", lines
+        assert not mock.commands, mock.commands
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_control_path_not_socket(binary):
+    mock = SwayMock()
+    path = mock.dir + "/control.sock"
+    with open(path, "w", encoding="ascii") as file:
+        file.write("data")
+    try:
+        env = dict(os.environ, SWAYSOCK=mock.path, XDG_RUNTIME_DIR=mock.dir,
+                   XDG_CONFIG_HOME=mock.dir + "/config")
+        proc = subprocess.run([binary, "--control", path], env=env,
+                              capture_output=True, text=True, timeout=5,
+                              check=False)
+        assert proc.returncode != 0, proc.stdout + proc.stderr
+        with open(path, encoding="ascii") as file:
+            assert file.read() == "data"
+    finally:
+        os.unlink(path)
+        mock.close()
+
+
+def test_workspace_scope(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    daemon = Daemon(binary, mock, "--scope", "workspace")
+    try:
+        assert mock.subscriptions == [["input", "workspace"]], \
+            mock.subscriptions
+        mock.user_switch(1)  # workspace "1" gets layout 1
+        settle()
+        mock.focus_workspace("2")
+        assert mock.wait_commands(1)
+        mock.focus_workspace("1")
+        assert mock.wait_commands(2)
+        assert [layout for _, layout in mock.commands] == [0, 1]
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+def test_reconnect(binary):
+    mock = SwayMock()
+    mock.add_window(10, title="Shell", focused=True)
+    mock.add_window(11, title="Editor")
+    mock.add_window(12, title="Mail")
+    path = mock.dir + "/control.sock"
+    daemon = Daemon(binary, mock, "--control", path)
+    try:
+        # all windows get layout 1, stored when they lose focus
+        mock.user_switch(1)
+        settle()
+        mock.focus(11, title="Editor")
+        assert mock.wait_commands(1)
+        mock.user_switch(1)
+        settle()
+        mock.focus(12, title="Mail")
+        assert mock.wait_commands(2)
+        mock.user_switch(1)
+        settle()
+        mock.focus(10, title="Shell")
+        settle()
+        mock.remove_window(11)  # closed while the connection is lost
+
+        # the compositor accepts connections and drops them at once
+        mock.refuse = True
+        mock.drop_subscribers()
+        settle(0.5)
+        assert daemon.proc.poll() is None, daemon.output()
+        assert "IPC connection lost" in daemon.output(), daemon.output()
+
+        mock.refuse = False
+        assert mock.wait_subscribed(), daemon.output()
+        assert len(mock.subscriptions) == 2, mock.subscriptions
+        lines = control(path, b"get 11\nget 12\n", 2)
+        assert lines == ["ok -1", "ok 1"], lines
+        assert daemon.stats()["reconnects"] == "1"
+
+        mock.focus(13)
+        assert mock.wait_commands(3)
+        mock.focus(12, title="Mail")
+        assert mock.wait_commands(4)
+        assert [layout for _, layout in mock.commands] == [0, 0, 0, 1]
+    finally:
+        daemon.stop()
+        mock.close()
+
+
+if __name__ == "__main__":
+    sys.exit(run_tests([
+        test_restore_window_layout,
+        test_tab_layouts,
+        test_keyboards_only,
+        test_control_socket,
+        test_unavailable_layout,
+        test_control_set_invalid,
+        test_control_path_not_socket,
+        test_workspace_scope,
+        test_reconnect,
+    ], sys.argv[1]))
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+// Benchmark of the layout store: focus changes over Zipf-distributed
+// windows, browser-like windows churn tabs, windows are closed and reopened.
+// Usage: layouts_bench [WINDOWS...], default is 64, 1024 and 16384 windows.
+
+#include "layouts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Number of focus changes (get + put) per run
+#define FOCUS_NUM 2000000
+// Limits of the stored states, defaults of the daemon
+#define LIMIT_WINDOW 256
+#define LIMIT_TOTAL  16384
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/** Get pseudo random number (xorshift64). */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/** Get monotonic time in nanoseconds. */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Get random index with Zipf distribution.
+ * @param[in] cdf cumulative distribution function
+ * @param[in] num number of entries in the distribution
+ * @return index
+ */
+static size_t zipf(const double* cdf, size_t num)
+{
+    const double val = (rng() >> 11) * (1.0 / 9007199254740992.0);
+    size_t lo = 0, hi = num - 1;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (cdf[mid] < val) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Run benchmark.
+ * @param[in] num number of windows
+ * @return false if not enough memory
+ */
+static bool run(size_t num)
+{
+    double* cdf = malloc(num * sizeof(*cdf));
+    uint32_t* ids = malloc(num * sizeof(*ids));
+    uint32_t next_id = 1;
+    double sum = 0;
+    uint64_t sink = 0;
+    struct layouts_stats stats;
+
+    if (!cdf || !ids) {
+        free(cdf);
+        free(ids);
+        return false;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        sum += 1.0 / (i + 1);
+        cdf[i] = sum;
+        ids[i] = next_id++;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        cdf[i] /= sum;
+    }
+
+    const double start = now();
+    for (size_t i = 0; i < FOCUS_NUM; ++i) {
+        const size_t wnd = zipf(cdf, num);
+        const uint64_t tab = wnd % 4 == 0 ? rng() % 64 : 0;
+        sink += get_layout(ids[wnd], tab);
+        put_layout(ids[wnd], tab, i & 3);
+        if ((rng() & 1023) == 0) {
+            rm_layout(ids[wnd]); // window closed, a new one is opened
+            ids[wnd] = next_id++;
+        }
+    }
+    const double end = now();
+
+    get_layouts_stats(&stats);
+    printf("windows %zu: %.1f ns/op, entries %zu, %.1f bytes/entry, "
+           "evictions %zu, allocs %zu (%d)\n",
+           num, (end - start) / (2.0 * FOCUS_NUM), stats.entries,
+           (double)stats.bytes / (stats.entries ? stats.entries : 1),
+           stats.evictions, stats.allocs, (int)(sink & 1));
+
+    // release the windows for the next run
+    for (size_t i = 0; i < num; ++i) {
+        rm_layout(ids[i]);
+    }
+    free(cdf);
+    free(ids);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    static const size_t defaults[] = { 64, 1024, 16384 };
+
+    if (!init_layouts(1024, NULL)) {
+        return EXIT_FAILURE;
+    }
+    set_layouts_limits(LIMIT_WINDOW, LIMIT_TOTAL);
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            const long num = strtol(argv[i], NULL, 0);
+            if (num <= 0 || !run(num)) {
+                fprintf(stderr, "Invalid number of windows: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            if (!run(defaults[i])) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,481 @@
+// SPDX-License-Identifier: MIT
+// Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+// Differential test of the layout store against a linear-scan model.
+// Random operations are applied to both, results and the LRU order must
+// match. Each scenario runs in a child process: the store is a singleton.
+// Usage: layouts_test [DIR], where DIR is used for storage files.
+
+#include "layouts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Number of random operations per scenario
+#define OPS_NUM 200000
+// Window ids are 1..WINDOWS_NUM, tab ids are 0..TABS_NUM-1
+#define WINDOWS_NUM 40
+#define TABS_NUM    8
+// Interval of full checks (LRU order and statistics), operations
+#define CHECK_INTERVAL 1000
+
+/** Model entry: state with the time of the last access. */
+struct model_entry {
+    uint32_t window;
+    uint64_t tab;
+    int layout;
+    uint64_t stamp;
+};
+
+/** Linear-scan model of the store. */
+struct model {
+    struct model_entry* entries;
+    size_t num;
+    size_t cap;
+    uint64_t clock;
+    size_t limit_window;
+    size_t limit_total;
+    bool windows[WINDOWS_NUM + 1]; ///< windows known to the store
+};
+
+static uint64_t rng_state;
+
+/** Get pseudo random number (xorshift64). */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/** Find model entry, returns -1 if not found. */
+static long model_find(const struct model* mdl, uint32_t window, uint64_t tab)
+{
+    for (size_t i = 0; i < mdl->num; ++i) {
+        if (mdl->entries[i].window == window && mdl->entries[i].tab == tab) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Find the least recently used entry, of the window if it is not 0. */
+static long model_lru(const struct model* mdl, uint32_t window)
+{
+    long lru = -1;
+    for (size_t i = 0; i < mdl->num; ++i) {
+        if ((!window || mdl->entries[i].window == window) &&
+            (lru < 0 || mdl->entries[i].stamp < mdl->entries[lru].stamp)) {
+            lru = i;
+        }
+    }
+    return lru;
+}
+
+static void model_del(struct model* mdl, size_t idx)
+{
+    mdl->entries[idx] = mdl->entries[--mdl->num];
+}
+
+static int model_get(struct model* mdl, uint32_t window, uint64_t tab)
+{
+    const long idx = model_find(mdl, window, tab);
+    if (idx < 0) {
+        return INVALID_LAYOUT;
+    }
+    mdl->entries[idx].stamp = ++mdl->clock;
+    return mdl->entries[idx].layout;
+}
+
+static int model_peek(const struct model* mdl, uint32_t window, uint64_t* tab)
+{
+    long mru = -1;
+    for (size_t i = 0; i < mdl->num; ++i) {
+        if (mdl->entries[i].window == window &&
+            (mru < 0 || mdl->entries[i].stamp > mdl->entries[mru].stamp)) {
+            mru = i;
+        }
+    }
+    if (mru < 0) {
+        return INVALID_LAYOUT;
+    }
+    *tab = mdl->entries[mru].tab;
+    return mdl->entries[mru].layout;
+}
+
+static void model_put(struct model* mdl, uint32_t window, uint64_t tab,
+                      int layout)
+{
+    long idx = model_find(mdl, window, tab);
+    if (idx >= 0) {
+        mdl->entries[idx].layout = layout;
+        mdl->entries[idx].stamp = ++mdl->clock;
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < mdl->num; ++i) {
+        count += mdl->entries[i].window == window;
+    }
+    if (mdl->limit_window && count >= mdl->limit_window) {
+        model_del(mdl, model_lru(mdl, window));
+    }
+    if (mdl->limit_total && mdl->num >= mdl->limit_total) {
+        model_del(mdl, model_lru(mdl, 0));
+    }
+
+    if (mdl->num == mdl->cap) {
+        mdl->cap = mdl->cap ? mdl->cap * 2 : 64;
+        mdl->entries = realloc(mdl->entries, mdl->cap * sizeof(*mdl->entries));
+        if (!mdl->entries) {
+            abort();
+        }
+    }
+    mdl->entries[mdl->num].window = window;
+    mdl->entries[mdl->num].tab = tab;
+    mdl->entries[mdl->num].layout = layout;
+    mdl->entries[mdl->num].stamp = ++mdl->clock;
+    ++mdl->num;
+    mdl->windows[window] = true;
+}
+
+static void model_rm(struct model* mdl, uint32_t window)
+{
+    for (size_t i = 0; i < mdl->num;) {
+        if (mdl->entries[i].window == window) {
+            model_del(mdl, i);
+        } else {
+            ++i;
+        }
+    }
+    mdl->windows[window] = false;
+}
+
+/** Position in the LRU order used by walk_check. */
+struct walk_state {
+    const struct model* mdl;
+    uint64_t stamp; ///< stamp of the previous entry
+    size_t count;
+    size_t errors;
+};
+
+/** Check that the store enumerates the model entries newest first. */
+static void walk_check(uint32_t window, uint64_t tab, int layout, void* data)
+{
+    struct walk_state* ws = data;
+    const long idx = model_find(ws->mdl, window, tab);
+    if (idx < 0 || ws->mdl->entries[idx].layout != layout ||
+        ws->mdl->entries[idx].stamp >= ws->stamp) {
+        ++ws->errors;
+    } else {
+        ws->stamp = ws->mdl->entries[idx].stamp;
+    }
+    ++ws->count;
+}
+
+/**
+ * Compare the whole store with the model.
+ * @return number of mismatches
+ */
+static size_t full_check(const struct model* mdl)
+{
+    struct walk_state ws = { mdl, UINT64_MAX, 0, 0 };
+    struct layouts_stats stats;
+    size_t windows = 0;
+
+    walk_layouts(walk_check, &ws);
+    get_layouts_stats(&stats);
+    for (size_t i = 1; i <= WINDOWS_NUM; ++i) {
+        windows += mdl->windows[i];
+    }
+
+    return ws.errors + (ws.count != mdl->num) + (stats.entries != mdl->num) +
+        (stats.windows != windows);
+}
+
+/**
+ * Apply random operation to the model and optionally to the store.
+ * @return number of mismatches
+ */
+static size_t random_op(struct model* mdl, bool store)
+{
+    const uint32_t window = 1 + rng() % WINDOWS_NUM;
+    const uint64_t tab = rng() % TABS_NUM;
+    const int layout = rng() % 4;
+    const unsigned int op = rng() % 20;
+    uint64_t tab_ref = 0, tab_st = 0;
+
+    if (op < 9) {
+        const int ref = model_get(mdl, window, tab);
+        return store && get_layout(window, tab) != ref;
+    }
+    if (op < 11) {
+        const int ref = model_peek(mdl, window, &tab_ref);
+        return store && (peek_layout(window, &tab_st) != ref ||
+                         (ref != INVALID_LAYOUT && tab_st != tab_ref));
+    }
+    if (op < 19) {
+        model_put(mdl, window, tab, layout);
+        if (store) {
+            put_layout(window, tab, layout);
+        }
+        return 0;
+    }
+    model_rm(mdl, window);
+    if (store) {
+        rm_layout(window);
+    }
+    return 0;
+}
+
+/**
+ * Run random operations.
+ * @param[in] mdl model
+ * @param[in] num number of operations
+ * @param[in] store true to apply operations to the store too
+ * @return number of mismatches
+ */
+static size_t run_ops(struct model* mdl, size_t num, bool store)
+{
+    size_t errors = 0;
+    for (size_t i = 0; i < num; ++i) {
+        errors += random_op(mdl, store);
+        if (store && i % CHECK_INTERVAL == 0) {
+            errors += full_check(mdl);
+        }
+    }
+    if (store) {
+        errors += full_check(mdl);
+    }
+    return errors;
+}
+
+/** Test parameters passed to the child process. */
+struct params {
+    size_t limit_window;
+    size_t limit_total;
+    uint64_t seed;
+    const char* file;
+};
+
+/** Run function in the child process, return its exit code. */
+static int run_child(int (*fn)(const struct params*), const struct params* p)
+{
+    int status;
+    const pid_t pid = fork();
+    if (pid == 0) {
+        _exit(fn(p));
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) == -1) {
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/** Differential test in memory: hash tables, pools growth and eviction. */
+static int test_memory(const struct params* p)
+{
+    struct model mdl = { 0 };
+    mdl.limit_window = p->limit_window;
+    mdl.limit_total = p->limit_total;
+    rng_state = p->seed;
+
+    // small capacity to exercise growth of the pools
+    if (!init_layouts(16, NULL)) {
+        return 1;
+    }
+    set_layouts_limits(p->limit_window, p->limit_total);
+
+    return run_ops(&mdl, OPS_NUM, true) != 0;
+}
+
+/** First part of persistence test: fill the storage file. */
+static int persist_write(const struct params* p)
+{
+    struct model mdl = { 0 };
+    mdl.limit_window = p->limit_window;
+    mdl.limit_total = p->limit_total;
+    rng_state = p->seed;
+
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    set_layouts_limits(p->limit_window, p->limit_total);
+
+    return run_ops(&mdl, OPS_NUM / 4, true) != 0;
+}
+
+/** Second part of persistence test: reload and continue. */
+static int persist_read(const struct params* p)
+{
+    struct model mdl = { 0 };
+    mdl.limit_window = p->limit_window;
+    mdl.limit_total = p->limit_total;
+    rng_state = p->seed;
+
+    // rebuild the model state from the same sequence of operations
+    run_ops(&mdl, OPS_NUM / 4, false);
+
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    set_layouts_limits(p->limit_window, p->limit_total);
+
+    return full_check(&mdl) + run_ops(&mdl, OPS_NUM / 4, true) != 0;
+}
+
+/** Check that the storage file is reset or not used. */
+static int expect_empty(const struct params* p)
+{
+    struct layouts_stats stats;
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    get_layouts_stats(&stats);
+    return stats.entries != 0;
+}
+
+/** Hold the storage file for a second. */
+static int hold_file(const struct params* p)
+{
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    put_layout(1, 0, 1);
+    sleep(1);
+    return 0;
+}
+
+/** Check restoring windows by signature after reload. */
+static int restore_check(const struct params* p)
+{
+    struct window_info list[WINDOWS_NUM];
+    size_t errors = 0;
+
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    // new container ids, signatures match the stored ones in reverse order
+    for (size_t i = 0; i < WINDOWS_NUM; ++i) {
+        list[i].id = 1000 + i;
+        list[i].app = WINDOWS_NUM - i;
+        list[i].title = (WINDOWS_NUM - i) * 7;
+    }
+    restore_layouts(list, WINDOWS_NUM);
+    for (size_t i = 0; i < WINDOWS_NUM; ++i) {
+        const uint32_t old = WINDOWS_NUM - i;
+        errors += get_layout(1000 + i, 0) != (int)(old % 3);
+        errors += get_layout(old, 0) != INVALID_LAYOUT;
+    }
+    return errors != 0;
+}
+
+/** Fill the storage with windows that have signatures. */
+static int restore_fill(const struct params* p)
+{
+    if (!init_layouts(16, p->file)) {
+        return 1;
+    }
+    for (uint32_t wnd = 1; wnd <= WINDOWS_NUM; ++wnd) {
+        put_window_info(wnd, wnd, wnd * 7);
+        put_layout(wnd, 0, wnd % 3);
+    }
+    // the same signature as another window, only one of them is restored
+    put_window_info(WINDOWS_NUM + 1, 1, 7);
+    put_layout(WINDOWS_NUM + 1, 0, 2);
+    return 0;
+}
+
+/**
+ * Corrupt 32-bit field of the storage file.
+ * @param[in] path path to the file
+ * @param[in] offset offset of the field
+ * @param[in] value value to write
+ * @return false on errors
+ */
+static bool corrupt(const char* path, long offset, uint32_t value)
+{
+    FILE* fp = fopen(path, "r+b");
+    if (!fp) {
+        return false;
+    }
+    const bool rc = fseek(fp, offset, SEEK_SET) == 0 &&
+        fwrite(&value, sizeof(value), 1, fp) == 1;
+    fclose(fp);
+    return rc;
+}
+
+/** Print and count the test result. */
+static size_t check(const char* name, int rc)
+{
+    printf("%s %s\n", rc == 0 ? "PASS" : "FAIL", name);
+    fflush(stdout);
+    return rc != 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const size_t limits[][2] = {
+        { 0, 0 }, { 4, 0 }, { 0, 50 }, { 3, 40 }, { 1, 1 },
+    };
+    char path[256];
+    size_t failed = 0;
+
+    snprintf(path, sizeof(path), "%s/layouts_test.%d",
+             argc > 1 ? argv[1] : "/tmp", (int)getpid());
+    fflush(stdout); // don't duplicate buffered output in children
+
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); ++i) {
+        const struct params p = { limits[i][0], limits[i][1],
+                                  0x9e3779b97f4a7c15ULL + i, path };
+        char name[64];
+
+        snprintf(name, sizeof(name), "memory window=%zu total=%zu",
+                 p.limit_window, p.limit_total);
+        failed += check(name, run_child(test_memory, &p));
+
+        unlink(path);
+        snprintf(name, sizeof(name), "persistence window=%zu total=%zu",
+                 p.limit_window, p.limit_total);
+        failed += check(name, run_child(persist_write, &p) ||
+                                  run_child(persist_read, &p));
+    }
+
+    // exclusive lock: the second instance doesn't use the file
+    const struct params p = { 0, 0, 1, path };
+    unlink(path);
+    const pid_t holder = fork();
+    if (holder == 0) {
+        _exit(hold_file(&p));
+    }
+    nanosleep(&(struct timespec) { 0, 200000000 }, NULL);
+    failed += check("locked file", run_child(expect_empty, &p));
+    waitpid(holder, NULL, 0);
+
+    // corrupted links: out of range head of the global LRU list
+    unlink(path);
+    run_child(persist_write, &p);
+    failed += check("corrupted LRU head",
+                    !corrupt(path, 20, 0x7fffffff) ||
+                        run_child(expect_empty, &p));
+
+    // corrupted links: wrong number of states of the window
+    unlink(path);
+    run_child(restore_fill, &p);
+    failed += check("corrupted window count",
+                    !corrupt(path, 32 + 40 + 12, 5) ||
+                        run_child(expect_empty, &p));
+
+    // restoring by signatures
+    unlink(path);
+    failed += check("restore", run_child(restore_fill, &p) ||
+                                   run_child(restore_check, &p));
+
+    unlink(path);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
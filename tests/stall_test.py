@@ -0,0 +1,87 @@
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+"""
+Stress test: the compositor stops reading commands during a focus flood.
+Superseded switch commands must be collapsed, the event loop must stay
+responsive and the keyboard must end on the last requested layout.
+"""
+
+import socket
+import sys
+import threading
+import time
+
+from sway_mock import SwayMock, Daemon, run_tests
+
+# Number of focus events in the flood
+FLOOD_SIZE = 20000
+# Max number of commands waiting for reply, see CMD_PENDING_MAX
+PENDING_MAX = 32
+
+
+def processed(stats):
+    return sum(value for name, value in stats.items()
+               if name.startswith("swaykbdd_events_processed_total"))
+
+
+def test_collapse_on_stall(binary):
+    mock = SwayMock()
+    mock.add_window(10, focused=True)
+    path = mock.dir + "/control.sock"
+    daemon = Daemon(binary, mock, "--control", path)
+    latency = []
+    stop = threading.Event()
+
+    def poll_control():
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.connect(path)
+            while not stop.is_set():
+                start = time.monotonic()
+                sock.sendall(b"get\n")
+                reply = b""
+                while not reply.endswith(b"\n"):
+                    reply += sock.recv(64)
+                latency.append(time.monotonic() - start)
+                time.sleep(0.001)
+
+    try:
+        mock.user_switch(1)  # window 10 gets layout 1, window 11 default 0
+        time.sleep(0.2)
+        mock.pause_commands()
+
+        poller = threading.Thread(target=poll_control)
+        poller.start()
+        for i in range(FLOOD_SIZE):
+            mock.focus(11 if i % 2 == 0 else 10)  # the last one is 10
+        deadline = time.monotonic() + 30
+        while processed(daemon.stats()) < FLOOD_SIZE + 1:
+            assert time.monotonic() < deadline, "flood is not consumed"
+            time.sleep(0.05)
+        stop.set()
+        poller.join()
+
+        stats = daemon.stats()
+        assert int(stats["collapsed commands"]) > 0, stats
+        assert latency and max(latency) < 0.5, max(latency)
+
+        sent = len(mock.commands)
+        mock.resume_commands()
+        time.sleep(0.5)
+        assert mock.layout() == 1, mock.layout()
+        # in flight commands plus the deferred one
+        assert len(mock.commands) - sent <= PENDING_MAX + 1, \
+            len(mock.commands) - sent
+        print(f"  flood: {FLOOD_SIZE} events, "
+              f"collapsed: {stats['collapsed commands']}, "
+              f"delivered after resume: {len(mock.commands) - sent}, "
+              f"control max latency: {max(latency) * 1000:.1f} ms")
+    finally:
+        stop.set()
+        mock.resume_commands()
+        daemon.stop()
+        mock.close()
+
+
+if __name__ == "__main__":
+    sys.exit(run_tests([test_collapse_on_stall], sys.argv[1]))
@@ -0,0 +1,399 @@
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020 Artem Senichev <artemsen@gmail.com>
+
+"""
+Stand-in for Sway IPC used by tests and benchmarks.
+
+SwayMock listens on a unix socket and speaks the i3-ipc framing: it answers
+SUBSCRIBE, COMMAND, GET_INPUTS and GET_TREE, emits xkb_layout events for
+executed layout switches and sends synthetic or recorded event streams.
+Daemon runs swaykbdd connected to the mock.
+"""
+
+import json
+import os
+import re
+import signal
+import socket
+import struct
+import subprocess
+import tempfile
+import threading
+import time
+
+IPC_MAGIC = b"i3-ipc"
+IPC_HEADER = struct.Struct("<6sII")
+IPC_COMMAND = 0
+IPC_SUBSCRIBE = 2
+IPC_GET_TREE = 4
+IPC_GET_INPUTS = 100
+IPC_EVENT_BIT = 0x80000000
+EVENT_WORKSPACE = IPC_EVENT_BIT | 0x00
+EVENT_WINDOW = IPC_EVENT_BIT | 0x03
+EVENT_INPUT = IPC_EVENT_BIT | 0x15
+
+# Record file written by swaykbdd --record
+RECORD_MAGIC = b"swkbdrec"
+RECORD_HEADER = struct.Struct("<8sII")
+RECORD_FRAME = struct.Struct("<QII")
+RECORD_SENT_BIT = 0x40000000
+
+SWITCH_RE = re.compile(r'input ("[^"]*"|\S+) xkb_switch_layout (\d+)')
+
+
+class SwayMock:
+    """Mock compositor."""
+
+    def __init__(self, layouts=("English", "Russian"), keyboards=1):
+        self.dir = tempfile.mkdtemp(prefix="swaykbdd-test-")
+        self.path = os.path.join(self.dir, "sway.sock")
+        self.keyboards = []
+        for i in range(keyboards):
+            self.keyboards.append({
+                "identifier": f"{i + 1}:{i + 1}:Keyboard {i + 1}",
+                "name": f"Keyboard {i + 1}",
+                "type": "keyboard",
+                "xkb_layout_names": list(layouts),
+                "xkb_active_layout_index": 0,
+            })
+        self.keyboards.append({"identifier": "9:9:Mouse", "name": "Mouse",
+                               "type": "pointer"})
+        self.workspace = {"id": 3, "type": "workspace", "name": "1",
+                          "nodes": [], "floating_nodes": []}
+        self.tree = {"id": 1, "type": "root", "floating_nodes": [],
+                     "nodes": [{"id": 2, "type": "output", "name": "eDP-1",
+                                "nodes": [self.workspace],
+                                "floating_nodes": []}]}
+        self.subscriptions = []  # lists of subscribed events
+        self.commands = []       # (monotonic ns, layout) of switches
+        self.lock = threading.Lock()
+        self.changed = threading.Condition(self.lock)
+        self.resumed = threading.Event()
+        self.resumed.set()
+        self.subscribers = []
+        self.refuse = False      # accept connections and drop them at once
+        self.server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.server.bind(self.path)
+        self.server.listen(8)
+        threading.Thread(target=self._accept, daemon=True).start()
+
+    def close(self):
+        self.resumed.set()
+        self.server.close()
+        try:
+            os.unlink(self.path)
+            os.rmdir(self.dir)
+        except OSError:
+            pass
+
+    def add_window(self, wnd_id, app_id="foot", title="title",
+                   focused=False):
+        """Add window to the tree returned by GET_TREE."""
+        self.workspace["nodes"].append({
+            "id": wnd_id, "type": "con", "app_id": app_id, "name": title,
+            "focused": focused, "nodes": [], "floating_nodes": []})
+
+    def remove_window(self, wnd_id):
+        """Remove window from the tree returned by GET_TREE."""
+        self.workspace["nodes"] = [wnd for wnd in self.workspace["nodes"]
+                                   if wnd["id"] != wnd_id]
+
+    def drop_subscribers(self):
+        """Close event connections, as a restarted compositor does."""
+        with self.changed:
+            conns = self.subscribers
+            self.subscribers = []
+        for conn in conns:
+            try:
+                conn.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            conn.close()
+
+    def focus(self, wnd_id, app_id="foot", title="title"):
+        self.window("focus", wnd_id, app_id, title)
+
+    def title(self, wnd_id, app_id="foot", title="title"):
+        self.window("title", wnd_id, app_id, title)
+
+    def close_window(self, wnd_id):
+        self.window("close", wnd_id)
+
+    def window(self, change, wnd_id, app_id="foot", title="title"):
+        self.event(EVENT_WINDOW, {
+            "change": change,
+            "container": {"id": wnd_id, "type": "con", "app_id": app_id,
+                          "name": title, "nodes": []}})
+
+    def focus_workspace(self, name, output="eDP-1"):
+        self.event(EVENT_WORKSPACE, {
+            "change": "focus",
+            "current": {"id": 100, "type": "workspace", "name": name,
+                        "output": output, "nodes": []},
+            "old": {"id": 101, "type": "workspace", "name": "old",
+                    "output": output, "nodes": []}})
+
+    def user_switch(self, layout):
+        """Switch layout as the user does it with a key binding."""
+        for kbd in self.keyboards:
+            if kbd["type"] == "keyboard":
+                self._set_layout(kbd, layout)
+
+    def layout(self):
+        """Get active layout of the first keyboard."""
+        return self.keyboards[0]["xkb_active_layout_index"]
+
+    def pause_commands(self):
+        """Stop reading the command channel, as a busy compositor does."""
+        self.resumed.clear()
+
+    def resume_commands(self):
+        self.resumed.set()
+
+    def wait_commands(self, num, timeout=5.0):
+        """Wait until the number of received switch commands reaches num."""
+        deadline = time.monotonic() + timeout
+        with self.changed:
+            while len(self.commands) < num:
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    return False
+                self.changed.wait(left)
+        return True
+
+    def wait_subscribed(self, timeout=5.0):
+        deadline = time.monotonic() + timeout
+        with self.changed:
+            while not self.subscribers:
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    return False
+                self.changed.wait(left)
+        return True
+
+    def event(self, event_type, payload):
+        data = json.dumps(payload).encode()
+        self.send_raw(event_type, data)
+
+    def send_raw(self, event_type, data):
+        frame = IPC_HEADER.pack(IPC_MAGIC, len(data), event_type) + data
+        for conn in list(self.subscribers):
+            try:
+                with self.lock:
+                    conn.sendall(frame)
+            except OSError:
+                self.subscribers.remove(conn)
+
+    def replay(self, path, rate=0):
+        """
+        Send events from the swaykbdd record file.
+        rate is events per second, 0 to keep the recorded timing.
+        """
+        with open(path, "rb") as file:
+            data = file.read()
+        magic, _, _ = RECORD_HEADER.unpack_from(data)
+        if magic != RECORD_MAGIC:
+            raise ValueError(f"{path} is not a record file")
+        pos = RECORD_HEADER.size
+        start = time.monotonic_ns()
+        first = None
+        sent = 0
+        while pos + RECORD_FRAME.size <= len(data):
+            ts, size, msg_type = RECORD_FRAME.unpack_from(data, pos)
+            pos += RECORD_FRAME.size
+            payload = data[pos:pos + size]
+            pos += size
+            if not msg_type & IPC_EVENT_BIT or msg_type & RECORD_SENT_BIT:
+                continue
+            if first is None:
+                first = ts
+            due = start + (sent * 1000000000 // rate if rate
+                           else ts - first)
+            delay = due - time.monotonic_ns()
+            if delay > 0:
+                time.sleep(delay / 1e9)
+            self.send_raw(msg_type, payload)
+            sent += 1
+        return sent
+
+    def _set_layout(self, kbd, layout):
+        if kbd["xkb_active_layout_index"] != layout:
+            kbd["xkb_active_layout_index"] = layout
+            self.event(EVENT_INPUT, {"change": "xkb_layout", "input": kbd})
+
+    def _accept(self):
+        while True:
+            try:
+                conn, _ = self.server.accept()
+            except OSError:
+                return
+            if self.refuse:
+                self._refuse(conn)
+                continue
+            threading.Thread(target=self._serve, args=(conn,),
+                             daemon=True).start()
+
+    def _refuse(self, conn):
+        """
+        Drop connection: stop reading before the client's next request and
+        close it, the client gets EPIPE on write.
+        """
+        try:
+            conn.shutdown(socket.SHUT_RD)
+            self._reply(conn, IPC_GET_INPUTS, self.keyboards)
+        except OSError:
+            pass
+        conn.close()
+
+    def _recv(self, conn, size):
+        data = b""
+        while len(data) < size:
+            chunk = conn.recv(size - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    def _reply(self, conn, msg_type, payload):
+        data = json.dumps(payload).encode()
+        with self.lock:
+            conn.sendall(IPC_HEADER.pack(IPC_MAGIC, len(data), msg_type) +
+                         data)
+
+    def _serve(self, conn):
+        commands = False
+        while True:
+            if commands:
+                self.resumed.wait()
+            try:
+                header = self._recv(conn, IPC_HEADER.size)
+                if not header:
+                    return
+                magic, size, msg_type = IPC_HEADER.unpack(header)
+                if magic != IPC_MAGIC:
+                    return
+                payload = self._recv(conn, size).decode() if size else ""
+            except OSError:
+                return
+            if msg_type == IPC_SUBSCRIBE:
+                self._reply(conn, msg_type, {"success": True})
+                with self.changed:
+                    self.subscriptions.append(json.loads(payload))
+                    self.subscribers.append(conn)
+                    self.changed.notify_all()
+            elif msg_type == IPC_GET_INPUTS:
+                self._reply(conn, msg_type, self.keyboards)
+            elif msg_type == IPC_GET_TREE:
+                self._reply(conn, msg_type, self.tree)
+            elif msg_type == IPC_COMMAND:
+                commands = True
+                self._command(conn, payload)
+            else:
+                self._reply(conn, msg_type, {"success": False})
+
+    def _command(self, conn, payload):
+        received = time.monotonic_ns()
+        results = []
+        switches = []
+        for cmd in payload.split(";"):
+            match = SWITCH_RE.search(cmd)
+            if not match:
+                results.append({"success": False, "error": "unknown"})
+                continue
+            target = match.group(1).strip('"')
+            layout = int(match.group(2))
+            for kbd in self.keyboards:
+                if kbd["type"] == "keyboard" and \
+                   target in ("type:keyboard", kbd["identifier"]):
+                    switches.append((kbd, layout))
+            results.append({"success": True})
+        self._reply(conn, IPC_COMMAND, results)
+        if switches:
+            with self.changed:
+                self.commands.append((received, switches[0][1]))
+                self.changed.notify_all()
+        for kbd, layout in switches:
+            self._set_layout(kbd, layout)
+
+
+class Daemon:
+    """swaykbdd process connected to the mock."""
+
+    def __init__(self, binary, mock, *args):
+        self.runtime = tempfile.mkdtemp(prefix="swaykbdd-run-")
+        env = dict(os.environ, SWAYSOCK=mock.path,
+                   XDG_RUNTIME_DIR=self.runtime,
+                   XDG_CONFIG_HOME=os.path.join(self.runtime, "config"))
+        self.lines = []
+        self.lock = threading.Condition()
+        self.proc = subprocess.Popen([binary, *args], env=env,
+                                     stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT, text=True)
+        threading.Thread(target=self._read, daemon=True).start()
+        if not mock.wait_subscribed():
+            self.stop()
+            raise RuntimeError("daemon is not connected:\n" + self.output())
+
+    def _read(self):
+        for line in self.proc.stdout:
+            with self.lock:
+                self.lines.append(line.rstrip("\n"))
+                self.lock.notify_all()
+
+    def output(self):
+        with self.lock:
+            return "\n".join(self.lines)
+
+    def stats(self, timeout=5.0):
+        """Get statistics printed on SIGUSR1 as a dictionary."""
+        with self.lock:
+            start = len(self.lines)
+        self.proc.send_signal(signal.SIGUSR1)
+        deadline = time.monotonic() + timeout
+        with self.lock:
+            # statistics and metrics are written at once, wait for the last
+            # group of counters and the end of output
+            count = 0
+            while count != len(self.lines) or not any(
+                    line.startswith("swaykbdd_events_duplicate_total")
+                    for line in self.lines[start:]):
+                count = len(self.lines)
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    raise RuntimeError("no statistics")
+                self.lock.wait(min(left, 0.05))
+            lines = self.lines[start:]
+        stats = {}
+        for line in lines:
+            if line.startswith("#"):
+                continue
+            if line.startswith("swaykbdd_"):
+                name, value = line.rsplit(" ", 1)
+                stats[name] = float(value)
+            elif ": " in line:
+                name, value = line.split(": ", 1)
+                stats[name] = value
+        return stats
+
+    def stop(self):
+        if self.proc.poll() is None:
+            self.proc.terminate()
+            try:
+                self.proc.wait(5)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+        return self.proc.returncode
+
+
+def run_tests(tests, *args):
+    """Run test functions, print results and return exit code."""
+    failed = 0
+    for test in tests:
+        try:
+            test(*args)
+            print(f"PASS {test.__name__}")
+        except Exception as ex:  # pylint: disable=broad-except
+            failed += 1
+            print(f"FAIL {test.__name__}: {ex!r}")
+    return 1 if failed else 0